@@ -2,14 +2,25 @@
 #include "mem.h"
 #include "types.h"
 #include "zialloc_memory.hpp"
+#include "zialloc_stats.h"
+#include "zialloc_trace.h"
 
+#include <cerrno>
+#include <cstdarg>
 #include <cstddef>
 #include <cstdint>
 #include <atomic>
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
-
-static bool g_initialized = false;
+#include <fcntl.h>
+#include <mutex>
+#include <pthread.h>
+#include <unistd.h>
+
+// set last by init; the lock only serializes threads racing the first call
+static std::atomic<bool> g_initialized{false};
+static std::mutex g_init_mu;
 static allocator_stats_t g_stats{};
 static std::atomic<uint64_t> g_alloc_count{0};
 static std::atomic<uint64_t> g_free_count{0};
@@ -28,6 +39,10 @@ struct LocalStatsBatch {
 };
 
 static thread_local LocalStatsBatch g_local_stats{0, 0, 0, 0, 0, 0};
+// bytes left before this thread's next profiler sample. kept apart from
+// the stats batch so the unsampled path is one subtract and one branch;
+// 0 sends the first allocation to profile_sample, which sets the real gap.
+static thread_local int64_t g_sample_countdown = 0;
 static constexpr uint32_t STATS_FLUSH_INTERVAL = 1024;
 
 static inline void flush_local_stats_batch() {
@@ -80,11 +95,22 @@ public:
   }
 
   void *malloc(size_t size);
+  void *memalign(size_t alignment, size_t size);
+  size_t malloc_batch(size_t size, size_t n, void **out);
   void free(void *ptr);
+  void free_sized(void *ptr, size_t size);
+  void bulk_free(void **ptrs, size_t n);
   void *realloc(void *ptr, size_t size);
+  void *realloc_array(void *ptr, size_t nmemb, size_t size);
   void *calloc(size_t nmemb, size_t size);
+  memory::Heap *heap_create();
+  void *heap_malloc(memory::Heap *heap, size_t size);
+  void heap_free(memory::Heap *heap, void *ptr);
+  void heap_release(memory::Heap *heap, bool destroy);
 
 private:
+  void *finish_alloc(void *ptr, size_t size);
+
   Allocator() = default;
   ~Allocator() = default;
 };
@@ -96,10 +122,28 @@ void *Allocator::malloc(size_t size) {
     return nullptr;
   if (size > HEAP_RESERVED_DEFAULT)
     return nullptr;
-  if (!g_initialized && zialloc_init() != 0)
+  if (!g_initialized.load(std::memory_order_acquire) && zialloc_init() != 0)
     return nullptr;
 
-  void *ptr = memory::heap_alloc(size);
+  return finish_alloc(memory::heap_alloc(size), size);
+}
+
+void *Allocator::memalign(size_t alignment, size_t size) {
+  if (!is_power_of_2(alignment))
+    return nullptr;
+  if (size == 0)
+    return nullptr;
+  if (size >= (SIZE_MAX - 4096))
+    return nullptr;
+  if (size > HEAP_RESERVED_DEFAULT)
+    return nullptr;
+  if (!g_initialized.load(std::memory_order_acquire) && zialloc_init() != 0)
+    return nullptr;
+
+  return finish_alloc(memory::heap_alloc_aligned(size, alignment), size);
+}
+
+void *Allocator::finish_alloc(void *ptr, size_t size) {
   if (!ptr)
     return nullptr;
 
@@ -111,13 +155,39 @@ void *Allocator::malloc(size_t size) {
   g_local_stats.bytes_allocated += size;
   g_local_stats.bytes_in_use_delta += static_cast<int64_t>(usable);
   maybe_flush_local_stats_batch();
+  if (__builtin_expect((g_sample_countdown -= static_cast<int64_t>(size)) < 0, 0))
+    g_sample_countdown = memory::profile_sample(ptr, size);
   return ptr;
 }
 
+size_t Allocator::malloc_batch(size_t size, size_t n, void **out) {
+  if (!out || n == 0 || size == 0)
+    return 0;
+  if (size >= (SIZE_MAX - 4096))
+    return 0;
+  if (size > HEAP_RESERVED_DEFAULT)
+    return 0;
+  if (!g_initialized.load(std::memory_order_acquire) && zialloc_init() != 0)
+    return 0;
+
+  const size_t got = memory::heap_alloc_batch(size, n, out);
+  const size_t usable = memory::heap_usable_for_request(size);
+  g_local_stats.alloc_count += got;
+  g_local_stats.bytes_allocated += size * got;
+  g_local_stats.bytes_in_use_delta += static_cast<int64_t>(usable * got);
+  maybe_flush_local_stats_batch();
+  // the batch crossing the threshold samples its last block
+  if (got && (g_sample_countdown -= static_cast<int64_t>(size * got)) < 0)
+    g_sample_countdown = memory::profile_sample(out[got - 1], size);
+  return got;
+}
+
 void Allocator::free(void *ptr) {
   if (!ptr)
     return;
-  IS_HEAP_INITIALIZED(g_initialized);
+  IS_HEAP_INITIALIZED(g_initialized.load(std::memory_order_relaxed));
+  if (memory::profile_has_samples())
+    memory::profile_forget(ptr);
 
   size_t usable = 0;
   if (!memory::free_dispatch_with_size(ptr, &usable))
@@ -128,33 +198,99 @@ void Allocator::free(void *ptr) {
   maybe_flush_local_stats_batch();
 }
 
+// the size goes along for the ride: XL sizes skip the page lookup, and a
+// size larger than the block aborts like any other corrupted free
+void Allocator::free_sized(void *ptr, size_t size) {
+  if (!ptr)
+    return;
+  IS_HEAP_INITIALIZED(g_initialized.load(std::memory_order_relaxed));
+  if (memory::profile_has_samples())
+    memory::profile_forget(ptr);
+
+  size_t usable = 0;
+  if (!memory::free_dispatch_sized(ptr, size, &usable))
+    std::abort();
+
+  g_local_stats.free_count++;
+  g_local_stats.bytes_in_use_delta -= static_cast<int64_t>(usable);
+  maybe_flush_local_stats_batch();
+}
+
+void Allocator::bulk_free(void **ptrs, size_t n) {
+  if (!ptrs || n == 0)
+    return;
+  IS_HEAP_INITIALIZED(g_initialized.load(std::memory_order_relaxed));
+  if (memory::profile_has_samples()) {
+    for (size_t i = 0; i < n; ++i) {
+      if (ptrs[i])
+        memory::profile_forget(ptrs[i]);
+    }
+  }
+
+  size_t freed = 0;
+  size_t usable = 0;
+  if (!memory::free_dispatch_bulk(ptrs, n, &freed, &usable))
+    std::abort();
+
+  g_local_stats.free_count += freed;
+  g_local_stats.bytes_in_use_delta -= static_cast<int64_t>(usable);
+  maybe_flush_local_stats_batch();
+}
+
 void *Allocator::realloc(void *ptr, size_t size) {
   if (ptr == nullptr)
     return malloc(size);
-  IS_HEAP_INITIALIZED(g_initialized);
+  IS_HEAP_INITIALIZED(g_initialized.load(std::memory_order_relaxed));
   if (size == 0) {
     free(ptr);
     return nullptr;
   }
 
   size_t old_usable = memory::heap_usable_size(ptr);
-  if (old_usable >= size) {
+
+  // a sampled block stays sampled wherever it ends up
+  const uint64_t sample =
+      memory::profile_has_samples() ? memory::profile_detach(ptr) : memory::PROFILE_NO_SAMPLE;
+
+  // XL -> XL resizes the mapping itself (mremap), so nothing is copied
+  size_t new_usable = 0;
+  if (void *resized = memory::heap_resize_xl(ptr, size, &new_usable)) {
+    memory::profile_reattach(sample, resized, size);
+    g_local_stats.bytes_in_use_delta +=
+        static_cast<int64_t>(new_usable) - static_cast<int64_t>(old_usable);
+    g_local_stats.realloc_count++;
+    maybe_flush_local_stats_batch();
+    return resized;
+  }
+
+  // keep the block unless it shrank enough to fit a class half its size
+  if (old_usable >= size && memory::heap_usable_for_request(size) > old_usable / 2) {
+    memory::profile_reattach(sample, ptr, size);
     g_local_stats.realloc_count++;
     maybe_flush_local_stats_batch();
     return ptr;
   }
 
   void *new_ptr = malloc(size);
-  if (!new_ptr)
+  if (!new_ptr) {
+    memory::profile_reattach(sample, ptr, 0);
     return nullptr;
+  }
 
-  std::memcpy(new_ptr, ptr, old_usable);
+  std::memcpy(new_ptr, ptr, old_usable < size ? old_usable : size);
   free(ptr);
+  memory::profile_reattach(sample, new_ptr, size);
   g_local_stats.realloc_count++;
   maybe_flush_local_stats_batch();
   return new_ptr;
 }
 
+void *Allocator::realloc_array(void *ptr, size_t nmemb, size_t size) {
+  if (nmemb != 0 && size > SIZE_MAX / nmemb)
+    return nullptr;
+  return realloc(ptr, nmemb * size);
+}
+
 void *Allocator::calloc(size_t nmemb, size_t size) {
   if (nmemb != 0 && size > SIZE_MAX / nmemb)
     return nullptr;
@@ -162,26 +298,149 @@ void *Allocator::calloc(size_t nmemb, size_t size) {
   void *ptr = malloc(total);
   if (!ptr)
     return nullptr;
-  std::memset(ptr, 0, total);
+  // fresh OS memory and scrubbed slots are already zero
+  const size_t dirty = memory::heap_last_alloc_dirty_bytes();
+  std::memset(ptr, 0, total < dirty ? total : dirty);
   return ptr;
 }
 
+memory::Heap *Allocator::heap_create() {
+  if (!g_initialized.load(std::memory_order_acquire) && zialloc_init() != 0)
+    return nullptr;
+  return memory::heap_create();
+}
+
+// counted like malloc, but never sampled: reset and destroy drop blocks
+// without the per-block free the profiler would need to see
+void *Allocator::heap_malloc(memory::Heap *heap, size_t size) {
+  if (!heap || size == 0)
+    return nullptr;
+  if (size >= (SIZE_MAX - 4096))
+    return nullptr;
+  if (size > HEAP_RESERVED_DEFAULT)
+    return nullptr;
+  IS_HEAP_INITIALIZED(g_initialized.load(std::memory_order_relaxed));
+
+  void *ptr = memory::heap_malloc(heap, size);
+  if (!ptr)
+    return nullptr;
+  size_t usable = memory::heap_last_alloc_usable();
+  if (usable == 0)
+    usable = memory::heap_usable_size(ptr);
+  g_local_stats.alloc_count++;
+  g_local_stats.bytes_allocated += size;
+  g_local_stats.bytes_in_use_delta += static_cast<int64_t>(usable);
+  maybe_flush_local_stats_batch();
+  return ptr;
+}
+
+void Allocator::heap_free(memory::Heap *heap, void *ptr) {
+  if (!ptr)
+    return;
+  IS_HEAP_INITIALIZED(g_initialized.load(std::memory_order_relaxed));
+  if (memory::profile_has_samples())
+    memory::profile_forget(ptr); // may be a plain malloc block
+
+  size_t usable = 0;
+  if (!heap || !memory::heap_free(heap, ptr, &usable))
+    std::abort();
+
+  g_local_stats.free_count++;
+  g_local_stats.bytes_in_use_delta -= static_cast<int64_t>(usable);
+  maybe_flush_local_stats_batch();
+}
+
+// reset and destroy count every still-live block as freed
+void Allocator::heap_release(memory::Heap *heap, bool destroy) {
+  if (!heap)
+    return;
+  IS_HEAP_INITIALIZED(g_initialized.load(std::memory_order_relaxed));
+
+  size_t freed = 0;
+  size_t usable = 0;
+  if (destroy)
+    memory::heap_destroy(heap, &freed, &usable);
+  else
+    memory::heap_reset(heap, &freed, &usable);
+
+  g_local_stats.free_count += freed;
+  g_local_stats.bytes_in_use_delta -= static_cast<int64_t>(usable);
+  maybe_flush_local_stats_batch();
+}
+
 } // namespace zialloc
 
+// the allocator_t entry points are what a trace records, so realloc's and
+// calloc's own trips through malloc and free show up once, as themselves
+using zialloc::memory::trace_enabled;
+using zialloc::memory::trace_record;
+
 static void *zialloc_malloc(size_t size) {
-  return zialloc::Allocator::instance().malloc(size);
+  void *p = zialloc::Allocator::instance().malloc(size);
+  if (trace_enabled())
+    trace_record(ZIALLOC_TRACE_MALLOC, nullptr, p, size, 0, 0);
+  return p;
+}
+
+static void *zialloc_memalign(size_t alignment, size_t size) {
+  void *p = zialloc::Allocator::instance().memalign(alignment, size);
+  if (trace_enabled())
+    trace_record(ZIALLOC_TRACE_MEMALIGN, nullptr, p, size, alignment, 0);
+  return p;
 }
 
+// C11: size should be a multiple of alignment, but like glibc we don't insist
+static void *zialloc_aligned_alloc(size_t alignment, size_t size) {
+  void *p = zialloc::Allocator::instance().memalign(alignment, size);
+  if (trace_enabled())
+    trace_record(ZIALLOC_TRACE_MEMALIGN, nullptr, p, size, alignment, 0);
+  return p;
+}
+
+// frees are recorded before the block can be handed to another thread
 static void zialloc_free(void *ptr) {
+  if (ptr && trace_enabled())
+    trace_record(ZIALLOC_TRACE_FREE, ptr, nullptr, 0, 0, 0);
   zialloc::Allocator::instance().free(ptr);
 }
 
+static void zialloc_free_sized(void *ptr, size_t size) {
+  if (ptr && trace_enabled())
+    trace_record(ZIALLOC_TRACE_FREE, ptr, nullptr, size, 0, 0);
+  zialloc::Allocator::instance().free_sized(ptr, size);
+}
+
+static void zialloc_bulk_free(void **ptrs, size_t n) {
+  if (ptrs && trace_enabled()) {
+    const uint64_t ts = zialloc::memory::trace_now();
+    for (size_t i = 0; i < n; ++i)
+      if (ptrs[i])
+        trace_record(ZIALLOC_TRACE_FREE, ptrs[i], nullptr, 0, 0, ts);
+  }
+  zialloc::Allocator::instance().bulk_free(ptrs, n);
+}
+
 static void *zialloc_realloc(void *ptr, size_t size) {
-  return zialloc::Allocator::instance().realloc(ptr, size);
+  const uint64_t ts = trace_enabled() ? zialloc::memory::trace_now() : 0;
+  void *p = zialloc::Allocator::instance().realloc(ptr, size);
+  if (ts)
+    trace_record(ZIALLOC_TRACE_REALLOC, ptr, p, size, 0, ts);
+  return p;
+}
+
+static void *zialloc_realloc_array(void *ptr, size_t nmemb, size_t size) {
+  const uint64_t ts = trace_enabled() ? zialloc::memory::trace_now() : 0;
+  void *p = zialloc::Allocator::instance().realloc_array(ptr, nmemb, size);
+  if (ts)
+    trace_record(ZIALLOC_TRACE_REALLOC, ptr, p, nmemb * size, 0, ts);
+  return p;
 }
 
 static void *zialloc_calloc(size_t nmemb, size_t size) {
-  return zialloc::Allocator::instance().calloc(nmemb, size);
+  void *p = zialloc::Allocator::instance().calloc(nmemb, size);
+  if (trace_enabled())
+    trace_record(ZIALLOC_TRACE_CALLOC, nullptr, p, size, nmemb, 0);
+  return p;
 }
 
 static size_t zialloc_usable_size(void *ptr) {
@@ -197,9 +456,19 @@ static allocator_stats_t zialloc_snapshot_stats(void) {
   snapshot.bytes_allocated = g_bytes_allocated.load(std::memory_order_relaxed);
   const int64_t in_use = g_bytes_in_use.load(std::memory_order_relaxed);
   snapshot.bytes_in_use = in_use > 0 ? static_cast<size_t>(in_use) : 0;
+  zialloc::memory::mapping_stats(&snapshot.bytes_mapped, &snapshot.mmap_count,
+                                 &snapshot.munmap_count);
   return snapshot;
 }
 
+#define ZIALLOC_COUNTER_ONE(name) +1
+static constexpr size_t ZIALLOC_COUNTER_COUNT = 0 ZIALLOC_COUNTERS(ZIALLOC_COUNTER_ONE);
+#undef ZIALLOC_COUNTER_ONE
+
+#define ZIALLOC_COUNTER_NAME(name) #name,
+static const char *const ZIALLOC_COUNTER_NAMES[] = {ZIALLOC_COUNTERS(ZIALLOC_COUNTER_NAME)};
+#undef ZIALLOC_COUNTER_NAME
+
 static void zialloc_print_stats(void) {
   allocator_stats_t snapshot = zialloc_snapshot_stats();
   printf("  Allocations:   %lu\n", (unsigned long)snapshot.alloc_count);
@@ -209,6 +478,19 @@ static void zialloc_print_stats(void) {
   printf("  Bytes mapped:  %zu\n", snapshot.bytes_mapped);
   printf("  mmap calls:    %lu\n", (unsigned long)snapshot.mmap_count);
   printf("  munmap calls:  %lu\n", (unsigned long)snapshot.munmap_count);
+  const unsigned nodes = zialloc::memory::heap_numa_nodes();
+  if (nodes > 1) {
+    for (unsigned n = 0; n < nodes; ++n) {
+      uint64_t segments = 0, remote_frees = 0, remote_pages = 0;
+      zialloc::memory::heap_numa_node_stats(n, &segments, &remote_frees, &remote_pages);
+      printf("  node %u:        %lu segments, %lu remote frees, %lu remote pages\n", n,
+             (unsigned long)segments, (unsigned long)remote_frees, (unsigned long)remote_pages);
+    }
+  }
+  uint64_t counters[ZIALLOC_COUNTER_COUNT];
+  zialloc::memory::heap_counters(counters, ZIALLOC_COUNTER_COUNT);
+  for (size_t i = 0; i < ZIALLOC_COUNTER_COUNT; ++i)
+    printf("  %-19s%lu\n", ZIALLOC_COUNTER_NAMES[i], (unsigned long)counters[i]);
 }
 
 static bool zialloc_get_stats(allocator_stats_t *stats) {
@@ -222,9 +504,106 @@ static bool zialloc_validate_heap(void) {
   return zialloc::memory::heap_validate();
 }
 
+extern allocator_t zialloc_allocator;
+
+// ZIALLOC_HUGEPAGES=1 backs segments and XL mappings with transparent huge pages
+static bool huge_pages_requested() {
+  const char *env = std::getenv("ZIALLOC_HUGEPAGES");
+  return env && env[0] != '\0' && env[0] != '0';
+}
+
+// ZIALLOC_PROF=1 turns the sampling profiler on at init, sampling every
+// ZIALLOC_PROF_INTERVAL bytes on average (default PROFILE_INTERVAL_DEFAULT);
+// ZIALLOC_PROF_SIGNAL=<signo> makes that signal dump a profile to a file
+static void profile_from_env() {
+  const char *env = std::getenv("ZIALLOC_PROF");
+  if (!env || env[0] == '\0' || env[0] == '0')
+    return;
+  size_t interval = PROFILE_INTERVAL_DEFAULT;
+  if (const char *iv = std::getenv("ZIALLOC_PROF_INTERVAL")) {
+    const unsigned long long v = std::strtoull(iv, nullptr, 10);
+    if (v > 0)
+      interval = static_cast<size_t>(v);
+  }
+  zialloc::memory::profile_enable(interval);
+  if (const char *sig = std::getenv("ZIALLOC_PROF_SIGNAL")) {
+    const int signo = std::atoi(sig);
+    if (signo > 0)
+      zialloc::memory::profile_install_signal(signo);
+  }
+}
+
+// ZIALLOC_BACKGROUND=<ms> starts the maintenance worker with that tick;
+// ZIALLOC_BACKGROUND_STATS=<path> has it append a zialloc_dump_stats line
+// to the file about once a second
+static constexpr uint64_t BACKGROUND_STATS_EVERY_NS = 1000000000ULL;
+static int g_background_stats_fd = -1;
+static uint64_t g_background_stats_next = 0; // touched only by the worker
+
+static void background_publish(uint64_t now) {
+  if (now < g_background_stats_next)
+    return;
+  g_background_stats_next = now + BACKGROUND_STATS_EVERY_NS;
+  (void)zialloc_dump_stats(g_background_stats_fd);
+}
+
+static void background_from_env() {
+  const char *env = std::getenv("ZIALLOC_BACKGROUND");
+  if (!env || env[0] == '\0')
+    return;
+  const unsigned long long ms = std::strtoull(env, nullptr, 10);
+  if (ms == 0)
+    return;
+  if (const char *path = std::getenv("ZIALLOC_BACKGROUND_STATS")) {
+    if (path[0] != '\0')
+      g_background_stats_fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  }
+  g_background_stats_next = 0;
+  if (!zialloc::memory::background_start(
+          ms, g_background_stats_fd >= 0 ? background_publish : nullptr) &&
+      g_background_stats_fd >= 0) {
+    close(g_background_stats_fd);
+    g_background_stats_fd = -1;
+  }
+}
+
+// ZIALLOC_TRACE=<prefix> records a trace to <prefix>.<pid>.trace from init on
+static void trace_from_env() {
+  const char *prefix = std::getenv("ZIALLOC_TRACE");
+  if (prefix && prefix[0] != '\0')
+    zialloc::memory::trace_start_prefix(prefix);
+}
+
+static void zialloc_fork_prepare(void) {
+  zialloc::memory::heap_fork_prepare();
+  zialloc::memory::profile_lock();
+  zialloc::memory::trace_lock();
+}
+static void zialloc_fork_parent(void) {
+  zialloc::memory::trace_unlock();
+  zialloc::memory::profile_unlock();
+  zialloc::memory::heap_fork_parent();
+}
+static void zialloc_fork_child(void) {
+  zialloc::memory::trace_fork_child();
+  zialloc::memory::profile_unlock();
+  zialloc::memory::heap_fork_child();
+}
+
 static int zialloc_init(void) {
-  if (g_initialized)
+  if (g_initialized.load(std::memory_order_acquire))
     return 0;
+  std::lock_guard<std::mutex> lk(g_init_mu);
+  if (g_initialized.load(std::memory_order_relaxed))
+    return 0;
+
+  // once per process: handlers outlive teardown/init cycles
+  static bool atfork_registered = false;
+  if (!atfork_registered) {
+    if (pthread_atfork(zialloc_fork_prepare, zialloc_fork_parent, zialloc_fork_child) != 0)
+      return -1;
+    atfork_registered = true;
+  }
 
   std::memset(&g_stats, 0, sizeof(g_stats));
   g_alloc_count.store(0, std::memory_order_relaxed);
@@ -233,37 +612,50 @@ static int zialloc_init(void) {
   g_bytes_allocated.store(0, std::memory_order_relaxed);
   g_bytes_in_use.store(0, std::memory_order_relaxed);
   g_local_stats = {0, 0, 0, 0, 0, 0};
+  zialloc::memory::reset_mapping_stats();
+  zialloc::memory::heap_reset_counters();
+
+  // must be set before anything is committed so every segment gets the hint
+  const bool huge = huge_pages_requested();
+  zialloc::memory::set_huge_pages_enabled(huge);
+  zialloc_allocator.features.huge_page_support = huge;
 
   const size_t heap_reserved_size = HEAP_RESERVED_DEFAULT;
-  void *reserved_base = zialloc::memory::reserve_region(heap_reserved_size);
+  // segment-aligned so every segment owns whole SEGMENT_SHIFT granules
+  void *reserved_base =
+      zialloc::memory::reserve_region_aligned(heap_reserved_size, SEGMENT_ALIGN);
   if (!reserved_base)
     return -1;
 
   if (!zialloc::memory::heap_init_reserved(reserved_base, heap_reserved_size))
     return -1;
 
-  // feature toggle: zero-on-free check, default disabled for speed
-  zialloc::memory::set_zero_on_free_enabled(false);
-  zialloc::memory::set_uaf_check_enabled(false);
+  zialloc::memory::set_purge_policy(PURGE_DELAY_DEFAULT_MS, PURGE_RETAINED_DEFAULT);
+  // a thread's last partial batch would otherwise die with its tls
+  zialloc::memory::set_thread_exit_hook(flush_local_stats_batch);
 
-  // keep one small/medium/large segment active from start
-  if (!zialloc::memory::heap_add_segment_for_class(PAGE_SM))
-    return -1;
-  if (!zialloc::memory::heap_add_segment_for_class(PAGE_MED))
-    return -1;
-  if (!zialloc::memory::heap_add_segment_for_class(PAGE_LG))
-    return -1;
+  profile_from_env();
+  trace_from_env();
+
+  // no segments yet: each class carves its first one on its first miss
 
-  g_initialized = true;
+  g_initialized.store(true, std::memory_order_release);
+  // after the flag: creating the thread allocates, and must not re-enter init
+  background_from_env();
   return 0;
 }
 
 static void zialloc_teardown(void) {
-  if (!g_initialized)
+  std::lock_guard<std::mutex> lk(g_init_mu);
+  if (!g_initialized.load(std::memory_order_acquire))
     return;
+  zialloc::memory::background_stop(); // it works on the heap going away
+  if (g_background_stats_fd >= 0) {
+    close(g_background_stats_fd);
+    g_background_stats_fd = -1;
+  }
+  zialloc::memory::profile_enable(0); // samples point into the heap going away
   zialloc::memory::heap_clear_metadata();
-  zialloc::memory::set_zero_on_free_enabled(false);
-  zialloc::memory::set_uaf_check_enabled(false);
   std::memset(&g_stats, 0, sizeof(g_stats));
   g_alloc_count.store(0, std::memory_order_relaxed);
   g_free_count.store(0, std::memory_order_relaxed);
@@ -271,7 +663,11 @@ static void zialloc_teardown(void) {
   g_bytes_allocated.store(0, std::memory_order_relaxed);
   g_bytes_in_use.store(0, std::memory_order_relaxed);
   g_local_stats = {0, 0, 0, 0, 0, 0};
-  g_initialized = false;
+  zialloc::memory::reset_mapping_stats();
+  zialloc::memory::heap_reset_counters();
+  zialloc::memory::set_huge_pages_enabled(false);
+  zialloc_allocator.features.huge_page_support = false;
+  g_initialized.store(false, std::memory_order_release);
 }
 
 allocator_t zialloc_allocator = {
@@ -279,12 +675,12 @@ allocator_t zialloc_allocator = {
     .free = zialloc_free,
     .realloc = zialloc_realloc,
     .calloc = zialloc_calloc,
-    .memalign = NULL,
-    .aligned_alloc = NULL,
+    .memalign = zialloc_memalign,
+    .aligned_alloc = zialloc_aligned_alloc,
     .usable_size = zialloc_usable_size,
-    .free_sized = NULL,
-    .realloc_array = NULL,
-    .bulk_free = NULL,
+    .free_sized = zialloc_free_sized,
+    .realloc_array = zialloc_realloc_array,
+    .bulk_free = zialloc_bulk_free,
     .print_stats = zialloc_print_stats,
     .validate_heap = zialloc_validate_heap,
     .get_stats = zialloc_get_stats,
@@ -302,14 +698,148 @@ allocator_t zialloc_allocator = {
             .huge_page_support = false,
             .guard_pages = false,
             .guard_location = GUARD_NONE,
+            // per-chunk canaries, which no policy adds; the hardened segment
+            // canary check (HeapPolicy::canary_check) is not that
             .canaries = false,
             .quarantine = false,
-            .zero_on_free = false,
+            .zero_on_free = HeapPolicy::zero_on_free,
             .min_alignment = 16,
-            .max_alignment = 16,
+            .max_alignment = MAX_ALIGNMENT,
         },
 };
 
 extern "C" allocator_t *get_test_allocator(void) { return &zialloc_allocator; }
 extern "C" allocator_t *get_bench_allocator(void) { return &zialloc_allocator; }
+
+// no slot in allocator_t for this one: fills `out` with up to `n` blocks of
+// `size` bytes, returns how many it got
+extern "C" size_t zialloc_malloc_batch(size_t size, size_t n, void **out) {
+  return zialloc::Allocator::instance().malloc_batch(size, n, out);
+}
+
+extern "C" bool zialloc_get_stats_ex(zialloc_stats_t *stats) {
+  if (!stats)
+    return false;
+  stats->base = zialloc_snapshot_stats();
+  uint64_t counters[ZIALLOC_COUNTER_COUNT];
+  zialloc::memory::heap_counters(counters, ZIALLOC_COUNTER_COUNT);
+  size_t i = 0;
+#define ZIALLOC_COUNTER_COPY(name) stats->name = counters[i++];
+  ZIALLOC_COUNTERS(ZIALLOC_COUNTER_COPY)
+#undef ZIALLOC_COUNTER_COPY
+  return true;
+}
+
+// bounded appends into a stack buffer; a truncated dump reports failure
+struct DumpBuf {
+  char data[4096];
+  size_t len;
+  bool overflow;
+
+  void add(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+    if (overflow)
+      return;
+    va_list ap;
+    va_start(ap, fmt);
+    const int n = vsnprintf(data + len, sizeof(data) - len, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= sizeof(data) - len)
+      overflow = true;
+    else
+      len += (size_t)n;
+  }
+};
+
+extern "C" int zialloc_dump_stats(int fd) {
+  zialloc_stats_t stats;
+  zialloc_get_stats_ex(&stats);
+  const allocator_stats_t &b = stats.base;
+
+  DumpBuf out{};
+  out.add("{\"alloc_count\":%lu,\"free_count\":%lu,\"realloc_count\":%lu,"
+          "\"bytes_allocated\":%zu,\"bytes_in_use\":%zu,\"bytes_mapped\":%zu,"
+          "\"mmap_count\":%lu,\"munmap_count\":%lu,\"counters\":{",
+          (unsigned long)b.alloc_count, (unsigned long)b.free_count,
+          (unsigned long)b.realloc_count, b.bytes_allocated, b.bytes_in_use, b.bytes_mapped,
+          (unsigned long)b.mmap_count, (unsigned long)b.munmap_count);
+  const char *sep = "";
+#define ZIALLOC_COUNTER_JSON(name)                                                    \
+  out.add("%s\"" #name "\":%lu", sep, (unsigned long)stats.name);                    \
+  sep = ",";
+  ZIALLOC_COUNTERS(ZIALLOC_COUNTER_JSON)
+#undef ZIALLOC_COUNTER_JSON
+  out.add("},\"numa\":[");
+  const unsigned nodes = zialloc::memory::heap_numa_nodes();
+  for (unsigned n = 0; n < nodes; ++n) {
+    uint64_t segments = 0, remote_frees = 0, remote_pages = 0;
+    zialloc::memory::heap_numa_node_stats(n, &segments, &remote_frees, &remote_pages);
+    out.add("%s{\"node\":%u,\"segments\":%lu,\"remote_frees\":%lu,\"remote_pages\":%lu}",
+            n ? "," : "", n, (unsigned long)segments, (unsigned long)remote_frees,
+            (unsigned long)remote_pages);
+  }
+  out.add("]}\n");
+  if (out.overflow)
+    return -1;
+
+  size_t off = 0;
+  while (off < out.len) {
+    const ssize_t w = write(fd, out.data + off, out.len - off);
+    if (w < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    off += (size_t)w;
+  }
+  return 0;
+}
+
+// interval 0 turns sampling off and drops every sample
+extern "C" bool zialloc_profile_enable(size_t interval_bytes) {
+  return zialloc::memory::profile_enable(interval_bytes);
+}
+
+extern "C" int zialloc_profile_dump(int fd) { return zialloc::memory::profile_dump(fd); }
+
+extern "C" bool zialloc_trace_start(const char *path) {
+  return zialloc::memory::trace_start(path);
+}
+
+extern "C" int zialloc_trace_stop(void) { return zialloc::memory::trace_stop(); }
+
+// request-scoped heaps; see zialloc_stats.h
+extern "C" zialloc_heap_t *zialloc_heap_create(void) {
+  return reinterpret_cast<zialloc_heap_t *>(zialloc::Allocator::instance().heap_create());
+}
+
+extern "C" void *zialloc_heap_malloc(zialloc_heap_t *heap, size_t size) {
+  return zialloc::Allocator::instance().heap_malloc(
+      reinterpret_cast<zialloc::memory::Heap *>(heap), size);
+}
+
+extern "C" void zialloc_heap_free(zialloc_heap_t *heap, void *ptr) {
+  zialloc::Allocator::instance().heap_free(reinterpret_cast<zialloc::memory::Heap *>(heap),
+                                           ptr);
+}
+
+extern "C" void zialloc_heap_reset(zialloc_heap_t *heap) {
+  zialloc::Allocator::instance().heap_release(reinterpret_cast<zialloc::memory::Heap *>(heap),
+                                              false);
+}
+
+extern "C" void zialloc_heap_destroy(zialloc_heap_t *heap) {
+  zialloc::Allocator::instance().heap_release(reinterpret_cast<zialloc::memory::Heap *>(heap),
+                                              true);
+}
+
+// numa nodes the heap splits its pools across; 1 on single-node machines
+extern "C" unsigned zialloc_numa_nodes(void) { return zialloc::memory::heap_numa_nodes(); }
+
+// per-node counters, charged to the node that owns the memory: segments
+// bound to it, frees into its pages from threads on other nodes, and pages
+// threads on other nodes adopted from it. false for a node out of range.
+extern "C" bool zialloc_numa_node_stats(unsigned node, uint64_t *segments,
+                                        uint64_t *remote_frees, uint64_t *remote_pages) {
+  return zialloc::memory::heap_numa_node_stats(node, segments, remote_frees, remote_pages);
+}
   
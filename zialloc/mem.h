@@ -41,20 +41,22 @@
   } while (0)
 
 typedef enum page_kind_e {
-  PAGE_SM,  // small blocks go into 1mib pages inside a segment
-  PAGE_MED, // medium   ^   ^   ^   8mib   ^    ^    ^    ^
-  PAGE_LG,  // large    ^   ^   ^   16mib     ^    ^    ^    ^
-  PAGE_XL   // x-large will either split(unlikely) or default to mmap.
+  PAGE_TINY, // tiny blocks go into 64kib pages inside a segment
+  PAGE_SM,   // small    ^   ^   ^   1mib   ^    ^    ^    ^
+  PAGE_MED,  // medium   ^   ^   ^   8mib   ^    ^    ^    ^
+  PAGE_LG,   // large    ^   ^   ^   16mib     ^    ^    ^    ^
+  PAGE_XL    // x-large will either split(unlikely) or default to mmap.
 } page_kind_t;
 
 constexpr size_t page_kind_size(int kind) {
-    return kind == PAGE_SM  ? (ZU(1) << SMALL_PAGE_SHIFT) :
+    return kind == PAGE_TINY ? TINY_PAGE_SIZE :
+           kind == PAGE_SM  ? (ZU(1) << SMALL_PAGE_SHIFT) :
            kind == PAGE_MED ? (ZU(1) << MEDIUM_PAGE_SHIFT) :
            kind == PAGE_LG  ? LARGE_PAGE_SIZE :
                               SEGMENT_SIZE;
 }
 
-typedef enum page_status_e { FULL, ACTIVE, EMPTY } page_status_t;
+typedef enum page_status_e { EMPTY, ACTIVE, FULL } page_status_t;
 
 // all power aligned (i think), we can fill unused space w/ guard chunks.
 // max_chunk <= (usable / 2) - alignment // so, ...
@@ -63,12 +65,43 @@ typedef enum page_status_e { FULL, ACTIVE, EMPTY } page_status_t;
 typedef enum chunk_max_e {
   // keep per-class max chunk <= ~half page so each page can hold at least 2
   // chunks even after metadata/alignment
+  CHUNK_TINY = 0x400,  // 1kib: the magazine classes, 64+ per tiny page
   CHUNK_SM = 0x7FFF0,  // 512kib - 16b
   CHUNK_MD = 0x3FFFF0, // 4mib - 16b
   CHUNK_LG = 0x7FFFF0, // 8mib - 16b
   CHUNK_XL             // whatever it wants to be
 } chunk_max_t;
 
+// hardening policy, fixed at build time so the default build has no
+// hardening branches at all: every check below is an `if constexpr`.
+// -DZIALLOC_HARDENED or -DZIALLOC_DEBUG picks one of the stricter policies.
+//   zero_on_free  freed chunks are cleared
+//   canary_check  every free and size lookup checks its segment's canary
+//   uaf_check     usable_size aborts on a free slot; frees skip the magazines,
+//                 so every double free hits the bitmap
+struct FastPolicy {
+  static constexpr bool zero_on_free = false;
+  static constexpr bool canary_check = false;
+  static constexpr bool uaf_check = false;
+};
+struct HardenedPolicy {
+  static constexpr bool zero_on_free = true;
+  static constexpr bool canary_check = true;
+  static constexpr bool uaf_check = false;
+};
+struct DebugPolicy {
+  static constexpr bool zero_on_free = true;
+  static constexpr bool canary_check = true;
+  static constexpr bool uaf_check = true;
+};
+#if defined(ZIALLOC_DEBUG)
+using HeapPolicy = DebugPolicy;
+#elif defined(ZIALLOC_HARDENED)
+using HeapPolicy = HardenedPolicy;
+#else
+using HeapPolicy = FastPolicy;
+#endif
+
 static inline pid_t current_tid() { return syscall(SYS_gettid); }
 
 static inline uint64_t generate_canary() {
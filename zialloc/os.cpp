@@ -4,11 +4,15 @@
     
 */
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <cerrno>
+#include <fcntl.h>
+#include <sched.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
 #include "types.h"
@@ -30,17 +34,52 @@ constexpr static inline size_t align_up(size_t size, size_t alignment) {
         0b0100_0000    =>   0x40     
 */
 
+// syscall accounting for allocator_stats_t. the call counts are logical: an
+// alignment trim is part of the map it trims, so mmap and munmap pair up.
+// bytes_mapped counts RW memory: anonymous maps plus whatever has been
+// committed out of the reservation.
+static std::atomic<uint64_t> g_mmap_calls{0};
+static std::atomic<uint64_t> g_munmap_calls{0};
+static std::atomic<int64_t>  g_bytes_mapped{0};
+
+// opt-in THP backing. segments are SEGMENT_ALIGN aligned, so every medium and
+// large page starts on a huge page boundary and small pages pair up into one.
+static std::atomic<bool> g_huge_pages{false};
+
+static inline void note_mmap(size_t rw_bytes) {
+    g_mmap_calls.fetch_add(1, std::memory_order_relaxed);
+    g_bytes_mapped.fetch_add((int64_t)rw_bytes, std::memory_order_relaxed);
+}
+
+static inline void note_munmap(size_t rw_bytes) {
+    g_munmap_calls.fetch_add(1, std::memory_order_relaxed);
+    g_bytes_mapped.fetch_sub((int64_t)rw_bytes, std::memory_order_relaxed);
+}
+
+// trimming slop off a fresh map: bytes only, no call
+static inline void note_trim(size_t rw_bytes) {
+    g_bytes_mapped.fetch_sub((int64_t)rw_bytes, std::memory_order_relaxed);
+}
+
 static inline size_t get_page_size() {
     static size_t pgsz = (size_t)sysconf(_SC_PAGESIZE);
     return pgsz;
 }
 
+// ask for transparent huge pages on a RW range when huge mode is on
+static void os_advise_huge(void* ptr, size_t size) {
+    if (!g_huge_pages.load(std::memory_order_relaxed) || size < HUGE_PAGE_SIZE)
+        return;
+    madvise(ptr, size, MADV_HUGEPAGE);
+}
+
 // alloc `size` bytes of anonymous memory w/ mmap
 // rets nullptr if fail, mem is zero init'd
 static void* os_mmap(size_t size) {
     void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
     if (ptr == MAP_FAILED) return nullptr;
+    note_mmap(size);
     return ptr;
 }   
 
@@ -59,14 +98,18 @@ static void* os_mmap_aligned(size_t size, size_t alignment) {
     uintptr_t aligned  = align_up(raw_addr, alignment);
 
     // trim leading slop
-    if (aligned > raw_addr)
+    if (aligned > raw_addr) {
         munmap(raw, aligned - raw_addr);
+        note_trim(aligned - raw_addr);
+    }
 
     // trim trailing slop
     uintptr_t end     = aligned + size;
     uintptr_t raw_end = raw_addr + alloc_size;
-    if (raw_end > end)
+    if (raw_end > end) {
         munmap((void*)end, raw_end - end);
+        note_trim(raw_end - end);
+    }
 
     return (void*)aligned;
 }
@@ -74,6 +117,7 @@ static void* os_mmap_aligned(size_t size, size_t alignment) {
 // used when an entire segment can be unmapped (virt + phys)
 static void os_munmap(void* ptr, size_t size) {
     munmap(ptr, size);
+    note_munmap(size);
 }
 
 // release physical pages but keep the virtual address reservation
@@ -129,24 +173,77 @@ static void* os_reserve_region(size_t size) {
     void* ptr = mmap(nullptr, size, PROT_NONE,
                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
     if (ptr == MAP_FAILED) return nullptr;
+    note_mmap(0);
     return ptr;
 }
 
+// reserve w/ the base aligned to `alignment`; over-reserve then trim like
+// os_mmap_aligned so segment granules never straddle the region
+static void* os_reserve_region_aligned(size_t size, size_t alignment) {
+    size_t alloc_size = size + alignment - 1;
+    void* raw = os_reserve_region(alloc_size);
+    if (!raw) return nullptr;
+
+    uintptr_t raw_addr = (uintptr_t)raw;
+    uintptr_t aligned  = align_up(raw_addr, alignment);
+
+    if (aligned > raw_addr)
+        munmap(raw, aligned - raw_addr);
+
+    uintptr_t end     = aligned + size;
+    uintptr_t raw_end = raw_addr + alloc_size;
+    if (raw_end > end)
+        munmap((void*)end, raw_end - end);
+
+    return (void*)aligned;
+}
+
+// resize a mapping without copying it. shrinking and in-place growth keep
+// the address; otherwise the pages are moved (not copied) onto a fresh
+// `alignment`-aligned reservation so the result stays segment-map friendly.
+static void* os_remap_aligned(void* ptr, size_t old_size, size_t new_size, size_t alignment) {
+    void* out = mremap(ptr, old_size, new_size, 0);
+    if (out == MAP_FAILED) {
+        void* dest = os_reserve_region_aligned(new_size, alignment);
+        if (!dest)
+            return nullptr;
+        out = mremap(ptr, old_size, new_size, MREMAP_MAYMOVE | MREMAP_FIXED, dest);
+        if (out == MAP_FAILED) {
+            munmap(dest, new_size);
+            note_munmap(0);
+            return nullptr;
+        }
+    }
+    g_bytes_mapped.fetch_add((int64_t)new_size - (int64_t)old_size, std::memory_order_relaxed);
+    return out;
+}
+
 // commit a subrange of a reserved region ot phys (make it read/write)
 // range must be w/i a region previously returned by os_reserve_region
 static bool os_commit_region(void* ptr, size_t size) {
-    return mprotect(ptr, size, PROT_READ | PROT_WRITE) == 0;
+    if (mprotect(ptr, size, PROT_READ | PROT_WRITE) != 0)
+        return false;
+    g_bytes_mapped.fetch_add((int64_t)size, std::memory_order_relaxed);
+    os_advise_huge(ptr, size);
+    return true;
 }
 
 // alloc a new segment-aligned region of `size` bytes.
 void* alloc_segment(size_t size) {
-    return os_mmap_aligned(size, SEGMENT_ALIGN);
+    void* ptr = os_mmap_aligned(size, SEGMENT_ALIGN);
+    if (ptr)
+        os_advise_huge(ptr, size);
+    return ptr;
 }
 
 void* reserve_region(size_t size) {
     return os_reserve_region(size);
 }
 
+void* reserve_region_aligned(size_t size, size_t alignment) {
+    return os_reserve_region_aligned(size, alignment);
+}
+
 bool commit_region(void* ptr, size_t size) {
     return os_commit_region(ptr, size);
 }
@@ -155,6 +252,10 @@ void free_segment(void* ptr, size_t size) {
     os_munmap(ptr, size);
 }
 
+void* remap_segment(void* ptr, size_t old_size, size_t new_size) {
+    return os_remap_aligned(ptr, old_size, new_size, SEGMENT_ALIGN);
+}
+
 // free physical, keep virtual
 void decommit_pages(void* ptr, size_t size) {
     os_decommit(ptr, size);
@@ -169,11 +270,74 @@ bool setup_guard(void* ptr, size_t size) {
     return os_create_guard(ptr, size);
 }
 
+void mapping_stats(size_t* bytes_mapped, uint64_t* mmap_calls, uint64_t* munmap_calls) {
+    const int64_t mapped = g_bytes_mapped.load(std::memory_order_relaxed);
+    if (bytes_mapped) *bytes_mapped = mapped > 0 ? (size_t)mapped : 0;
+    if (mmap_calls) *mmap_calls = g_mmap_calls.load(std::memory_order_relaxed);
+    if (munmap_calls) *munmap_calls = g_munmap_calls.load(std::memory_order_relaxed);
+}
+
+void reset_mapping_stats() {
+    g_mmap_calls.store(0, std::memory_order_relaxed);
+    g_munmap_calls.store(0, std::memory_order_relaxed);
+    g_bytes_mapped.store(0, std::memory_order_relaxed);
+}
+
+void set_huge_pages_enabled(bool enabled) {
+    g_huge_pages.store(enabled, std::memory_order_relaxed);
+}
+
+bool huge_pages_enabled() {
+    return g_huge_pages.load(std::memory_order_relaxed);
+}
+
 // any access segfaults.
 void lock_page(void* ptr, size_t size) {
     os_protect_none(ptr, size);
 }
 
+// numa: raw syscalls and sysfs, no libnuma. this runs under malloc, so no
+// stdio either.
+static constexpr int OS_MPOL_PREFERRED = 1; // <linux/mempolicy.h>
+
+// highest node in /sys/devices/system/node/possible, plus one. the list
+// looks like "0" or "0-3" or "0,2-3"; the last number is the highest.
+unsigned numa_node_count() {
+    int fd = open("/sys/devices/system/node/possible", O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 1;
+    char buf[64];
+    const ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return 1;
+    unsigned last = 0;
+    for (ssize_t i = 0; i < n; ++i) {
+        if (buf[i] >= '0' && buf[i] <= '9')
+            last = last * 10 + (unsigned)(buf[i] - '0');
+        else if (buf[i] == '-' || buf[i] == ',')
+            last = 0;
+    }
+    const unsigned nodes = last + 1;
+    return nodes > NUMA_MAX_NODES ? NUMA_MAX_NODES : nodes;
+}
+
+// vdso on x86-64, so cheap but not free: callers cache it
+unsigned current_numa_node() {
+    unsigned cpu = 0, node = 0;
+    if (getcpu(&cpu, &node) != 0)
+        return 0;
+    return node < NUMA_MAX_NODES ? node : NUMA_MAX_NODES - 1;
+}
+
+// preferred rather than bind: a full node spills to its neighbours instead
+// of failing the fault. best effort, the caller carries on either way.
+bool bind_to_node(void* ptr, size_t size, unsigned node) {
+    unsigned long mask = 1UL << node;
+    return syscall(SYS_mbind, ptr, size, OS_MPOL_PREFERRED, &mask,
+                   sizeof(mask) * 8, 0) == 0;
+}
+
 void unlock_page(void* ptr, size_t size) {
     os_protect_rw(ptr, size);
 }
@@ -196,6 +360,10 @@ void* reserve_region(size_t size) {
     return zialloc::os::reserve_region(size);
 }
 
+void* reserve_region_aligned(size_t size, size_t alignment) {
+    return zialloc::os::reserve_region_aligned(size, alignment);
+}
+
 bool commit_region(void* ptr, size_t size) {
     return zialloc::os::commit_region(ptr, size);
 }
@@ -204,6 +372,10 @@ void free_segment(void* ptr, size_t size) {
     zialloc::os::free_segment(ptr, size);
 }
 
+void* remap_segment(void* ptr, size_t old_size, size_t new_size) {
+    return zialloc::os::remap_segment(ptr, old_size, new_size);
+}
+
 void decommit_pages(void* ptr, size_t size) {
     zialloc::os::decommit_pages(ptr, size);
 }
@@ -216,6 +388,22 @@ bool setup_guard(void* ptr, size_t size) {
     return zialloc::os::setup_guard(ptr, size);
 }
 
+void mapping_stats(size_t* bytes_mapped, uint64_t* mmap_calls, uint64_t* munmap_calls) {
+    zialloc::os::mapping_stats(bytes_mapped, mmap_calls, munmap_calls);
+}
+
+void reset_mapping_stats() {
+    zialloc::os::reset_mapping_stats();
+}
+
+void set_huge_pages_enabled(bool enabled) {
+    zialloc::os::set_huge_pages_enabled(enabled);
+}
+
+bool huge_pages_enabled() {
+    return zialloc::os::huge_pages_enabled();
+}
+
 void lock_page(void* ptr, size_t size) {
     zialloc::os::lock_page(ptr, size);
 }
@@ -224,6 +412,18 @@ void unlock_page(void* ptr, size_t size) {
     zialloc::os::unlock_page(ptr, size);
 }
 
+unsigned numa_node_count() {
+    return zialloc::os::numa_node_count();
+}
+
+unsigned current_numa_node() {
+    return zialloc::os::current_numa_node();
+}
+
+bool bind_to_node(void* ptr, size_t size, unsigned node) {
+    return zialloc::os::bind_to_node(ptr, size, node);
+}
+
 } // namespace zialloc::memory
 
 
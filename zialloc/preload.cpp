@@ -0,0 +1,250 @@
+// drop-in malloc replacement: build as libzialloc.so and LD_PRELOAD it, or
+// link it in. every libc/C++ allocation entry point lands on the zialloc
+// vtable.
+//
+// the first call runs init, and anything init itself allocates (libc and
+// libstdc++ internals, pthread_atfork) is served from a small static
+// bootstrap buffer instead of recursing. bootstrap blocks are never
+// reused; free ignores them and realloc moves them onto the real heap.
+
+#include "allocator.h"
+#include "types.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+extern allocator_t zialloc_allocator;
+
+namespace {
+
+static constexpr size_t BOOTSTRAP_BYTES = 64 * KB;
+static constexpr size_t BOOTSTRAP_ALIGN = 16;
+
+struct alignas(BOOTSTRAP_ALIGN) BootstrapHeader {
+  size_t size;
+};
+
+alignas(CACHE_LINE_SIZE) static char g_bootstrap[BOOTSTRAP_BYTES];
+static std::atomic<size_t> g_bootstrap_used{0};
+static std::atomic<bool> g_ready{false};
+// initial-exec: touching this must not itself allocate TLS
+static thread_local bool t_in_init __attribute__((tls_model("initial-exec"))) = false;
+
+static inline bool is_bootstrap(const void *ptr) {
+  const char *p = static_cast<const char *>(ptr);
+  return p >= g_bootstrap && p < g_bootstrap + BOOTSTRAP_BYTES;
+}
+
+static void *bootstrap_alloc(size_t size, size_t alignment) {
+  if (alignment < BOOTSTRAP_ALIGN)
+    alignment = BOOTSTRAP_ALIGN;
+  size_t cur = g_bootstrap_used.load(std::memory_order_relaxed);
+  for (;;) {
+    const uintptr_t base = reinterpret_cast<uintptr_t>(g_bootstrap);
+    const uintptr_t user =
+        (base + cur + sizeof(BootstrapHeader) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    const size_t end = (user - base) + ((size + BOOTSTRAP_ALIGN - 1) & ~(BOOTSTRAP_ALIGN - 1));
+    if (end > BOOTSTRAP_BYTES || size > BOOTSTRAP_BYTES)
+      return nullptr;
+    if (g_bootstrap_used.compare_exchange_weak(cur, end, std::memory_order_relaxed)) {
+      reinterpret_cast<BootstrapHeader *>(user)[-1].size = size;
+      return reinterpret_cast<void *>(user); // static storage: already zero
+    }
+  }
+}
+
+static inline size_t bootstrap_size(const void *ptr) {
+  return reinterpret_cast<const BootstrapHeader *>(ptr)[-1].size;
+}
+
+// false while this thread is inside init: the caller uses the bootstrap
+// buffer. other threads block on init's lock and then see it done.
+static inline bool ensure_ready() {
+  if (__builtin_expect(g_ready.load(std::memory_order_acquire), 1))
+    return true;
+  if (t_in_init)
+    return false;
+  t_in_init = true;
+  const bool ok = zialloc_allocator.init() == 0;
+  t_in_init = false;
+  if (ok)
+    g_ready.store(true, std::memory_order_release);
+  return ok;
+}
+
+// libc callers expect malloc(0) to hand out a unique pointer
+static inline size_t nonzero(size_t size) { return size ? size : 1; }
+
+// the C entry points report a failed allocation through errno, as POSIX asks
+static inline void *or_enomem(void *p) {
+  if (!p)
+    errno = ENOMEM;
+  return p;
+}
+
+static void *alloc_aligned(size_t alignment, size_t size) {
+  if (!ensure_ready())
+    return bootstrap_alloc(nonzero(size), alignment);
+  return zialloc_allocator.memalign(alignment, nonzero(size));
+}
+
+static void *new_impl(size_t size, size_t alignment) {
+  for (;;) {
+    void *p = alignment > BOOTSTRAP_ALIGN ? alloc_aligned(alignment, size)
+                                          : (ensure_ready() ? zialloc_allocator.malloc(nonzero(size))
+                                                            : bootstrap_alloc(nonzero(size), 0));
+    if (p)
+      return p;
+    std::new_handler handler = std::get_new_handler();
+    if (!handler)
+      throw std::bad_alloc();
+    handler();
+  }
+}
+
+static void *new_nothrow(size_t size, size_t alignment) noexcept {
+  try {
+    return new_impl(size, alignment);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+} // namespace
+
+extern "C" {
+
+void *malloc(size_t size) {
+  if (!ensure_ready())
+    return or_enomem(bootstrap_alloc(nonzero(size), 0));
+  return or_enomem(zialloc_allocator.malloc(nonzero(size)));
+}
+
+void free(void *ptr) {
+  if (!ptr || is_bootstrap(ptr))
+    return;
+  zialloc_allocator.free(ptr);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  if (nmemb != 0 && size > SIZE_MAX / nmemb) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  if (!ensure_ready())
+    return or_enomem(bootstrap_alloc(nonzero(nmemb * size), 0));
+  if (nmemb == 0 || size == 0)
+    nmemb = size = 1;
+  return or_enomem(zialloc_allocator.calloc(nmemb, size));
+}
+
+void *realloc(void *ptr, size_t size) {
+  if (ptr && is_bootstrap(ptr)) {
+    void *out = malloc(size);
+    if (out) {
+      const size_t old = bootstrap_size(ptr);
+      std::memcpy(out, ptr, old < size ? old : size);
+    }
+    return out;
+  }
+  if (!ptr)
+    return malloc(size);
+  if (size == 0)
+    return zialloc_allocator.realloc(ptr, 0); // frees: NULL is no failure
+  return or_enomem(zialloc_allocator.realloc(ptr, size));
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size) {
+  if (nmemb != 0 && size > SIZE_MAX / nmemb) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  return realloc(ptr, nmemb * size);
+}
+
+int posix_memalign(void **out, size_t alignment, size_t size) {
+  if (!is_power_of_2(alignment) || alignment % sizeof(void *) != 0)
+    return EINVAL;
+  void *p = alloc_aligned(alignment, size);
+  if (!p)
+    return ENOMEM;
+  *out = p;
+  return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+  if (!is_power_of_2(alignment)) {
+    errno = EINVAL;
+    return nullptr;
+  }
+  return or_enomem(alloc_aligned(alignment, size));
+}
+
+void *memalign(size_t alignment, size_t size) {
+  if (!is_power_of_2(alignment)) {
+    errno = EINVAL;
+    return nullptr;
+  }
+  return or_enomem(alloc_aligned(alignment, size));
+}
+
+void *valloc(size_t size) { return or_enomem(alloc_aligned(4096, size)); }
+
+void *pvalloc(size_t size) {
+  if (size > SIZE_MAX - 4095) {
+    errno = ENOMEM;
+    return nullptr;
+  }
+  return or_enomem(alloc_aligned(4096, (size + 4095) & ~(size_t)4095));
+}
+
+size_t malloc_usable_size(void *ptr) {
+  if (!ptr)
+    return 0;
+  if (is_bootstrap(ptr))
+    return bootstrap_size(ptr);
+  return zialloc_allocator.usable_size(ptr);
+}
+
+void free_sized(void *ptr, size_t size) {
+  if (!ptr || is_bootstrap(ptr))
+    return;
+  zialloc_allocator.free_sized(ptr, size);
+}
+
+void free_aligned_sized(void *ptr, size_t alignment, size_t size) {
+  (void)alignment;
+  free_sized(ptr, size);
+}
+
+} // extern "C"
+
+void *operator new(size_t size) { return new_impl(size, 0); }
+void *operator new[](size_t size) { return new_impl(size, 0); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return new_nothrow(size, 0); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return new_nothrow(size, 0); }
+void *operator new(size_t size, std::align_val_t al) { return new_impl(size, static_cast<size_t>(al)); }
+void *operator new[](size_t size, std::align_val_t al) { return new_impl(size, static_cast<size_t>(al)); }
+void *operator new(size_t size, std::align_val_t al, const std::nothrow_t &) noexcept {
+  return new_nothrow(size, static_cast<size_t>(al));
+}
+void *operator new[](size_t size, std::align_val_t al, const std::nothrow_t &) noexcept {
+  return new_nothrow(size, static_cast<size_t>(al));
+}
+
+void operator delete(void *ptr) noexcept { free(ptr); }
+void operator delete[](void *ptr) noexcept { free(ptr); }
+void operator delete(void *ptr, const std::nothrow_t &) noexcept { free(ptr); }
+void operator delete[](void *ptr, const std::nothrow_t &) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t size) noexcept { free_sized(ptr, size); }
+void operator delete[](void *ptr, size_t size) noexcept { free_sized(ptr, size); }
+void operator delete(void *ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete[](void *ptr, std::align_val_t) noexcept { free(ptr); }
+void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { free(ptr); }
+void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { free(ptr); }
+void operator delete(void *ptr, size_t size, std::align_val_t) noexcept { free_sized(ptr, size); }
+void operator delete[](void *ptr, size_t size, std::align_val_t) noexcept { free_sized(ptr, size); }
@@ -0,0 +1,426 @@
+/*
+    sampling heap profiler. allocations are sampled by bytes: each thread
+    counts down an exponentially distributed interval (mean
+    `interval` bytes, so samples form a poisson process over allocated
+    bytes) and the allocation that crosses zero records its stack. live
+    samples sit in a chained hash table keyed by address; frees look for
+    their pointer only behind a counting filter, so unsampled frees mostly
+    cost one load. dumps use the legacy gperftools heap format that pprof
+    reads (heap_v2, unsampled by pprof itself from the period).
+
+    nothing here uses the libc heap: records live in a reserved region and
+    dumps format into stack buffers and write(2) straight to the fd.
+*/
+
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <mutex>
+#include <unistd.h>
+#include <unwind.h>
+
+#include "types.h"
+#include "mem.h"
+#include "zialloc_memory.hpp"
+
+namespace zialloc::memory {
+
+std::atomic<size_t> g_profile_live_samples{0};
+
+namespace {
+
+static constexpr size_t PROFILE_MAX_SAMPLES = 16384;
+static constexpr size_t PROFILE_BUCKETS = 4096;
+static constexpr size_t PROFILE_FILTER_SLOTS = 65536;
+static constexpr uint32_t PROFILE_MAX_DEPTH = 32;
+static constexpr uint32_t PROFILE_SKIP_FRAMES = 2; // capture and profile_sample
+static constexpr uint32_t PROFILE_NIL = UINT32_MAX;
+// while sampling is off a thread re-checks every this many bytes, so it picks
+// up an enable within a bounded amount of allocation
+static constexpr int64_t PROFILE_IDLE_RECHECK = 64 * MB;
+
+struct SampleRecord {
+  void *ptr;
+  size_t size;
+  uint32_t next; // bucket chain, or the free list
+  uint32_t depth;
+  void *stack[PROFILE_MAX_DEPTH];
+};
+
+static constexpr size_t PROFILE_REGION_BYTES =
+    (PROFILE_MAX_SAMPLES * sizeof(SampleRecord) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+static std::atomic<size_t> g_interval{0}; // mean bytes between samples, 0 = off
+static std::mutex g_profile_mu;           // guards everything below
+static SampleRecord *g_records = nullptr;
+static uint32_t g_buckets[PROFILE_BUCKETS];
+static uint32_t g_free_head = PROFILE_NIL; // a full table drops new samples
+static uint32_t g_epoch = 0;               // bumped by drop_all: stale detach handles
+
+// live samples per hashed address; nonzero means "maybe sampled"
+static std::atomic<uint16_t> g_filter[PROFILE_FILTER_SLOTS];
+
+static std::atomic<bool> g_dump_pending{false};
+static std::atomic<uint32_t> g_dump_seq{0};
+
+static thread_local uint64_t t_rng = 0;
+static thread_local bool t_in_sampler = false;
+
+static inline uint64_t mix(uintptr_t p) { return (uint64_t)(p >> 4) * 0x9E3779B97F4A7C15ULL; }
+static inline size_t bucket_for(const void *ptr) {
+  return mix(reinterpret_cast<uintptr_t>(ptr)) >> (64 - 12);
+}
+static inline size_t filter_for(const void *ptr) {
+  return (mix(reinterpret_cast<uintptr_t>(ptr)) >> 20) & (PROFILE_FILTER_SLOTS - 1);
+}
+static_assert(PROFILE_BUCKETS == (ZU(1) << 12), "bucket_for takes the top 12 bits");
+
+// xorshift64*, seeded per thread
+static inline uint64_t next_random() {
+  if (t_rng == 0) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    t_rng = ((uint64_t)current_tid() << 32) ^ (uint64_t)ts.tv_nsec ^ 0x2545F4914F6CDD1DULL;
+    if (t_rng == 0)
+      t_rng = 1;
+  }
+  t_rng ^= t_rng >> 12;
+  t_rng ^= t_rng << 25;
+  t_rng ^= t_rng >> 27;
+  return t_rng * 0x2545F4914F6CDD1DULL;
+}
+
+// exponential with mean `interval`: the gap to the next sampled byte
+static inline int64_t next_interval(size_t interval) {
+  const double u = ((double)(next_random() >> 11) + 1.0) / 9007199254740993.0; // (0, 1]
+  const double gap = -std::log(u) * (double)interval;
+  if (gap < 1.0)
+    return 1;
+  if (gap > (double)(INT64_MAX / 2))
+    return INT64_MAX / 2;
+  return (int64_t)gap;
+}
+
+struct UnwindState {
+  void **out;
+  uint32_t depth;
+  uint32_t skip;
+};
+
+static _Unwind_Reason_Code unwind_frame(struct _Unwind_Context *ctx, void *arg) {
+  UnwindState *st = static_cast<UnwindState *>(arg);
+  const uintptr_t ip = _Unwind_GetIP(ctx);
+  if (ip == 0)
+    return _URC_END_OF_STACK;
+  if (st->skip > 0) {
+    st->skip--;
+    return _URC_NO_REASON;
+  }
+  st->out[st->depth++] = reinterpret_cast<void *>(ip);
+  return st->depth == PROFILE_MAX_DEPTH ? _URC_END_OF_STACK : _URC_NO_REASON;
+}
+
+// caller holds g_profile_mu
+static bool ensure_records_locked() {
+  if (g_records)
+    return true;
+  void *mem = reserve_region(PROFILE_REGION_BYTES);
+  if (!mem)
+    return false;
+  if (!commit_region(mem, PROFILE_REGION_BYTES)) {
+    free_segment(mem, PROFILE_REGION_BYTES);
+    return false;
+  }
+  g_records = static_cast<SampleRecord *>(mem);
+  for (uint32_t i = 0; i < PROFILE_MAX_SAMPLES; ++i)
+    g_records[i].next = i + 1 < PROFILE_MAX_SAMPLES ? i + 1 : PROFILE_NIL;
+  g_free_head = 0;
+  for (uint32_t &b : g_buckets)
+    b = PROFILE_NIL;
+  return true;
+}
+
+// caller holds g_profile_mu
+static void drop_all_locked() {
+  if (!g_records)
+    return;
+  for (uint32_t &b : g_buckets)
+    b = PROFILE_NIL;
+  for (uint32_t i = 0; i < PROFILE_MAX_SAMPLES; ++i)
+    g_records[i].next = i + 1 < PROFILE_MAX_SAMPLES ? i + 1 : PROFILE_NIL;
+  g_free_head = 0;
+  for (std::atomic<uint16_t> &f : g_filter)
+    f.store(0, std::memory_order_relaxed);
+  g_profile_live_samples.store(0, std::memory_order_relaxed);
+  g_epoch++;
+}
+
+// caller holds g_profile_mu: takes `ptr`'s record out of its chain
+static uint32_t unlink_locked(void *ptr) {
+  if (!g_records)
+    return PROFILE_NIL;
+  uint32_t *link = &g_buckets[bucket_for(ptr)];
+  while (*link != PROFILE_NIL) {
+    SampleRecord &r = g_records[*link];
+    if (r.ptr == ptr) {
+      const uint32_t idx = *link;
+      *link = r.next;
+      g_filter[filter_for(ptr)].fetch_sub(1, std::memory_order_relaxed);
+      return idx;
+    }
+    link = &r.next;
+  }
+  return PROFILE_NIL;
+}
+
+// caller holds g_profile_mu
+static void release_locked(uint32_t idx) {
+  g_records[idx].next = g_free_head;
+  g_free_head = idx;
+  g_profile_live_samples.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// bounded appends into a stack buffer, flushed to `fd` as it fills
+struct ProfileWriter {
+  int fd;
+  bool failed;
+  size_t len;
+  char buf[4096];
+
+  void flush() {
+    size_t off = 0;
+    while (!failed && off < len) {
+      const ssize_t w = write(fd, buf + off, len - off);
+      if (w < 0) {
+        if (errno == EINTR)
+          continue;
+        failed = true;
+      } else {
+        off += (size_t)w;
+      }
+    }
+    len = 0;
+  }
+
+  void add(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+    for (int attempt = 0; attempt < 2; ++attempt) {
+      va_list ap;
+      va_start(ap, fmt);
+      const int n = vsnprintf(buf + len, sizeof(buf) - len, fmt, ap);
+      va_end(ap);
+      if (n < 0) {
+        failed = true;
+        return;
+      }
+      if ((size_t)n < sizeof(buf) - len) {
+        len += (size_t)n;
+        return;
+      }
+      flush(); // did not fit: retry into an empty buffer
+    }
+    failed = true;
+  }
+};
+
+static void write_maps(ProfileWriter &w) {
+  w.add("\nMAPPED_LIBRARIES:\n");
+  w.flush();
+  const int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+  if (maps < 0)
+    return;
+  for (;;) {
+    const ssize_t n = read(maps, w.buf, sizeof(w.buf));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    w.len = (size_t)n;
+    w.flush();
+  }
+  close(maps);
+}
+
+// caller holds g_profile_mu
+static int dump_locked(int fd) {
+  ProfileWriter w{fd, false, 0, {}};
+  uint64_t objs = 0;
+  uint64_t bytes = 0;
+  if (g_records) {
+    for (uint32_t b = 0; b < PROFILE_BUCKETS; ++b) {
+      for (uint32_t i = g_buckets[b]; i != PROFILE_NIL; i = g_records[i].next) {
+        objs++;
+        bytes += g_records[i].size;
+      }
+    }
+  }
+  w.add("heap profile: %lu: %lu [%lu: %lu] @ heap_v2/%zu\n", (unsigned long)objs,
+        (unsigned long)bytes, (unsigned long)objs, (unsigned long)bytes,
+        g_interval.load(std::memory_order_relaxed));
+  if (g_records) {
+    for (uint32_t b = 0; b < PROFILE_BUCKETS; ++b) {
+      for (uint32_t i = g_buckets[b]; i != PROFILE_NIL; i = g_records[i].next) {
+        const SampleRecord &r = g_records[i];
+        w.add("1: %zu [1: %zu] @", r.size, r.size);
+        for (uint32_t d = 0; d < r.depth; ++d)
+          w.add(" %p", r.stack[d]);
+        w.add("\n");
+      }
+    }
+  }
+  write_maps(w);
+  w.flush();
+  return w.failed ? -1 : 0;
+}
+
+// a dump asked for by signal: written from the next sampling thread, which
+// is outside any allocator lock. ZIALLOC_PROF_FILE picks the path prefix.
+static void dump_to_file_locked() {
+  const char *prefix = std::getenv("ZIALLOC_PROF_FILE");
+  if (!prefix || prefix[0] == '\0')
+    prefix = "zialloc";
+  char path[512];
+  const uint32_t seq = g_dump_seq.fetch_add(1, std::memory_order_relaxed);
+  std::snprintf(path, sizeof(path), "%s.%d.%u.heap", prefix, (int)getpid(), seq);
+  const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return;
+  (void)dump_locked(fd);
+  close(fd);
+}
+
+static void on_dump_signal(int) { g_dump_pending.store(true, std::memory_order_relaxed); }
+
+} // namespace
+
+bool profile_enable(size_t interval_bytes) {
+  std::lock_guard<std::mutex> lk(g_profile_mu);
+  if (interval_bytes == 0) {
+    g_interval.store(0, std::memory_order_relaxed);
+    drop_all_locked();
+    return true;
+  }
+  if (!ensure_records_locked())
+    return false;
+  g_interval.store(interval_bytes, std::memory_order_relaxed);
+  return true;
+}
+
+bool profile_enabled() { return g_interval.load(std::memory_order_relaxed) != 0; }
+
+// ZIALLOC_PROF_SIGNAL=<signo>: that signal requests a dump to a file
+bool profile_install_signal(int signo) {
+  struct sigaction sa;
+  std::memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_dump_signal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  return sigaction(signo, &sa, nullptr) == 0;
+}
+
+int64_t profile_sample(void *ptr, size_t size) {
+  const size_t interval = g_interval.load(std::memory_order_relaxed);
+  if (interval == 0)
+    return PROFILE_IDLE_RECHECK;
+  // allocations made while capturing (unwinder internals) are never sampled
+  if (t_in_sampler)
+    return next_interval(interval);
+  t_in_sampler = true;
+
+  void *stack[PROFILE_MAX_DEPTH];
+  UnwindState st{stack, 0, PROFILE_SKIP_FRAMES};
+  _Unwind_Backtrace(unwind_frame, &st);
+
+  {
+    std::lock_guard<std::mutex> lk(g_profile_mu);
+    if (g_records && g_interval.load(std::memory_order_relaxed) != 0 &&
+        g_free_head != PROFILE_NIL) {
+      const uint32_t idx = g_free_head;
+      SampleRecord &r = g_records[idx];
+      g_free_head = r.next;
+      r.ptr = ptr;
+      r.size = size;
+      r.depth = st.depth;
+      std::memcpy(r.stack, stack, st.depth * sizeof(void *));
+      const size_t b = bucket_for(ptr);
+      r.next = g_buckets[b];
+      g_buckets[b] = idx;
+      g_filter[filter_for(ptr)].fetch_add(1, std::memory_order_relaxed);
+      g_profile_live_samples.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (g_dump_pending.exchange(false, std::memory_order_relaxed))
+      dump_to_file_locked();
+  }
+
+  t_in_sampler = false;
+  return next_interval(interval);
+}
+
+// before `ptr` is freed, so no other thread can be handed it and sample it
+void profile_forget(void *ptr) {
+  if (g_filter[filter_for(ptr)].load(std::memory_order_relaxed) == 0)
+    return;
+  std::lock_guard<std::mutex> lk(g_profile_mu);
+  const uint32_t idx = unlink_locked(ptr);
+  if (idx != PROFILE_NIL)
+    release_locked(idx);
+}
+
+// realloc: the sample leaves the table before the block can move, so a
+// thread handed the old address can't be mistaken for it, and is put back
+// under wherever the block ends up
+uint64_t profile_detach(void *ptr) {
+  if (g_filter[filter_for(ptr)].load(std::memory_order_relaxed) == 0)
+    return PROFILE_NO_SAMPLE;
+  std::lock_guard<std::mutex> lk(g_profile_mu);
+  const uint32_t idx = unlink_locked(ptr);
+  if (idx == PROFILE_NIL)
+    return PROFILE_NO_SAMPLE;
+  return (uint64_t)g_epoch << 32 | idx;
+}
+
+// `size` 0 keeps the recorded size. a block the new allocation already
+// sampled keeps that sample; the detached one is dropped
+void profile_reattach(uint64_t handle, void *ptr, size_t size) {
+  if (handle == PROFILE_NO_SAMPLE)
+    return;
+  std::lock_guard<std::mutex> lk(g_profile_mu);
+  if ((uint32_t)(handle >> 32) != g_epoch)
+    return; // dropped by profile_enable(0) meanwhile
+  const uint32_t idx = (uint32_t)handle;
+  bool sampled = false;
+  for (uint32_t i = g_buckets[bucket_for(ptr)]; i != PROFILE_NIL && !sampled;
+       i = g_records[i].next)
+    sampled = g_records[i].ptr == ptr;
+  if (sampled) {
+    release_locked(idx);
+    return;
+  }
+  SampleRecord &r = g_records[idx];
+  r.ptr = ptr;
+  if (size != 0)
+    r.size = size;
+  const size_t b = bucket_for(ptr);
+  r.next = g_buckets[b];
+  g_buckets[b] = idx;
+  g_filter[filter_for(ptr)].fetch_add(1, std::memory_order_relaxed);
+}
+
+int profile_dump(int fd) {
+  std::lock_guard<std::mutex> lk(g_profile_mu);
+  return dump_locked(fd);
+}
+
+// fork: the table lock is a leaf, taken after the heap's own locks
+void profile_lock() { g_profile_mu.lock(); }
+void profile_unlock() { g_profile_mu.unlock(); }
+
+} // namespace zialloc::memory
@@ -0,0 +1,301 @@
+/*
+    allocation trace recorder. while a trace runs every malloc, calloc,
+    memalign, realloc and free that goes through the allocator_t entry points
+    appends one record (zialloc_trace.h) to a buffer owned by the calling
+    thread; the hot path is a clock read and a few stores, no lock. a thread
+    takes the file lock only to write its buffer out when it fills, so records
+    reach the file in per-thread runs and the reader sorts them by time.
+
+    buffers belong to a thread for its whole life and are recycled when it
+    exits. stop writes out every buffer's pending records under the lock; the
+    owners keep appending past what was written, and a record that races stop
+    is simply not in the file. a new trace bumps the session so each owner
+    throws away its stale buffer and takes a fresh tid on its next record.
+
+    nothing here uses the libc heap: buffers live in a reserved region and
+    records go to the fd with write(2).
+*/
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <mutex>
+#include <unistd.h>
+
+#include "types.h"
+#include "mem.h"
+#include "zialloc_memory.hpp"
+#include "zialloc_trace.h"
+
+namespace zialloc::memory {
+
+std::atomic<bool> g_trace_on{false};
+
+namespace {
+
+static constexpr uint32_t TRACE_MAX_THREADS = 1024;
+// with the header fields a buffer is exactly 48 pages, so buffers commit
+// page by page without sharing one
+static constexpr uint32_t TRACE_BUFFER_RECORDS = 4095;
+
+struct TraceBuffer {
+  std::atomic<uint32_t> count; // records appended, written only by the owner
+  uint32_t flushed;            // records already in the file, under g_trace_mu
+  uint32_t session;            // trace the records belong to
+  uint32_t tid;
+  bool owned;                   // bound to a live thread, under g_trace_mu
+  char pad[sizeof(zialloc_trace_record_t) - 17];
+  zialloc_trace_record_t recs[TRACE_BUFFER_RECORDS];
+};
+static_assert(sizeof(TraceBuffer) % 4096 == 0, "buffers commit in whole pages");
+
+static constexpr size_t TRACE_REGION_BYTES = TRACE_MAX_THREADS * sizeof(TraceBuffer);
+
+static std::mutex g_trace_mu; // guards everything below but the atomics
+static TraceBuffer *g_buffers = nullptr;
+static uint32_t g_buffers_committed = 0;
+static int g_fd = -1;
+static bool g_failed = false;
+static uint64_t g_written = 0;
+static uint32_t g_next_tid = 0;
+static zialloc_trace_header_t g_header;
+static char g_prefix[512]; // set by an env-started trace so forked children get their own file
+static std::atomic<uint32_t> g_session{0};
+static std::atomic<uint64_t> g_dropped{0};
+
+struct TraceThread {
+  TraceBuffer *buf;
+  bool exited;
+  ~TraceThread();
+};
+static thread_local TraceThread t_trace{nullptr, false};
+
+static bool write_all(int fd, const void *data, size_t len, off_t at) {
+  const char *p = static_cast<const char *>(data);
+  while (len > 0) {
+    const ssize_t n = at < 0 ? write(fd, p, len) : pwrite(fd, p, len, at);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= static_cast<size_t>(n);
+    if (at >= 0)
+      at += n;
+  }
+  return true;
+}
+
+// caller holds g_trace_mu. writes [flushed, upto) of `b` if it belongs to
+// the running trace
+static void flush_locked(TraceBuffer *b, uint32_t upto) {
+  if (upto <= b->flushed)
+    return;
+  if (g_fd >= 0 && !g_failed && b->session == g_session.load(std::memory_order_relaxed)) {
+    const size_t n = upto - b->flushed;
+    if (write_all(g_fd, &b->recs[b->flushed], n * sizeof(zialloc_trace_record_t), -1))
+      g_written += n;
+    else
+      g_failed = true;
+  }
+  b->flushed = upto;
+}
+
+// caller holds g_trace_mu: point `b` at the running trace with a fresh tid
+static void rebind_locked(TraceBuffer *b) {
+  b->count.store(0, std::memory_order_relaxed);
+  b->flushed = 0;
+  b->session = g_session.load(std::memory_order_relaxed);
+  b->tid = ++g_next_tid;
+}
+
+static TraceBuffer *claim_buffer() {
+  std::lock_guard<std::mutex> lk(g_trace_mu);
+  if (!g_buffers) {
+    g_buffers = static_cast<TraceBuffer *>(reserve_region(TRACE_REGION_BYTES));
+    if (!g_buffers)
+      return nullptr;
+  }
+  TraceBuffer *b = nullptr;
+  for (uint32_t i = 0; i < g_buffers_committed && !b; ++i)
+    if (!g_buffers[i].owned)
+      b = &g_buffers[i];
+  if (!b) {
+    if (g_buffers_committed == TRACE_MAX_THREADS)
+      return nullptr;
+    b = &g_buffers[g_buffers_committed];
+    if (!commit_region(b, sizeof(TraceBuffer)))
+      return nullptr;
+    g_buffers_committed++;
+  }
+  b->owned = true;
+  rebind_locked(b);
+  return b;
+}
+
+// thread exit: hand what is left to the file and the buffer to the next
+// thread. frees from later thread_local destructors are dropped.
+TraceThread::~TraceThread() {
+  exited = true;
+  TraceBuffer *b = buf;
+  buf = nullptr;
+  if (!b)
+    return;
+  std::lock_guard<std::mutex> lk(g_trace_mu);
+  flush_locked(b, b->count.load(std::memory_order_acquire));
+  b->owned = false;
+}
+
+// caller holds g_trace_mu
+static bool start_locked(const char *path) {
+  if (g_fd >= 0)
+    return false;
+  const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    return false;
+  std::memset(&g_header, 0, sizeof(g_header));
+  g_header.magic = ZIALLOC_TRACE_MAGIC;
+  g_header.version = ZIALLOC_TRACE_VERSION;
+  g_header.record_size = sizeof(zialloc_trace_record_t);
+  g_header.start_ns = trace_now();
+  g_header.pid = static_cast<uint32_t>(getpid());
+  if (!write_all(fd, &g_header, sizeof(g_header), -1)) {
+    close(fd);
+    return false;
+  }
+  g_fd = fd;
+  g_failed = false;
+  g_written = 0;
+  g_next_tid = 0;
+  g_dropped.store(0, std::memory_order_relaxed);
+  g_session.fetch_add(1, std::memory_order_relaxed);
+  g_trace_on.store(true, std::memory_order_release);
+  return true;
+}
+
+// caller holds g_trace_mu
+static int stop_locked() {
+  if (g_fd < 0)
+    return -1;
+  g_trace_on.store(false, std::memory_order_relaxed);
+  for (uint32_t i = 0; i < g_buffers_committed; ++i)
+    if (g_buffers[i].owned)
+      flush_locked(&g_buffers[i], g_buffers[i].count.load(std::memory_order_acquire));
+  g_header.records = g_written;
+  g_header.dropped = g_dropped.load(std::memory_order_relaxed);
+  g_header.threads = g_next_tid;
+  if (!write_all(g_fd, &g_header, sizeof(g_header), 0))
+    g_failed = true;
+  close(g_fd);
+  g_fd = -1;
+  return g_failed ? -1 : 0;
+}
+
+// a trace still running at exit is finished by the last static destructor
+struct TraceAtExit {
+  ~TraceAtExit() { trace_stop(); }
+};
+static TraceAtExit g_trace_at_exit;
+
+} // namespace
+
+uint64_t trace_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void trace_record(uint32_t op, const void *ptr, const void *result, size_t size, uint64_t aux,
+                  uint64_t ts) {
+  if (ts == 0)
+    ts = trace_now();
+  TraceThread &t = t_trace;
+  TraceBuffer *b = t.buf;
+  if (!b) {
+    if (t.exited || !(b = claim_buffer())) {
+      g_dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    t.buf = b;
+  }
+  uint32_t n = b->count.load(std::memory_order_relaxed);
+  if (b->session != g_session.load(std::memory_order_relaxed) || n == TRACE_BUFFER_RECORDS) {
+    std::lock_guard<std::mutex> lk(g_trace_mu);
+    if (b->session == g_session.load(std::memory_order_relaxed)) {
+      flush_locked(b, n);
+      b->count.store(0, std::memory_order_relaxed);
+      b->flushed = 0;
+    } else {
+      rebind_locked(b);
+    }
+    n = 0;
+  }
+  zialloc_trace_record_t &r = b->recs[n];
+  r.ts_ns = ts;
+  r.ptr = reinterpret_cast<uintptr_t>(ptr);
+  r.result = reinterpret_cast<uintptr_t>(result);
+  r.size = size;
+  r.aux = aux;
+  r.tid = b->tid;
+  r.op = op;
+  b->count.store(n + 1, std::memory_order_release);
+}
+
+bool trace_start(const char *path) {
+  if (!path || path[0] == '\0')
+    return false;
+  std::lock_guard<std::mutex> lk(g_trace_mu);
+  g_prefix[0] = '\0';
+  return start_locked(path);
+}
+
+// ZIALLOC_TRACE=<prefix>: trace to <prefix>.<pid>.trace, and likewise in
+// every forked child
+bool trace_start_prefix(const char *prefix) {
+  if (!prefix || prefix[0] == '\0' || std::strlen(prefix) >= sizeof(g_prefix))
+    return false;
+  char path[sizeof(g_prefix) + 32];
+  std::snprintf(path, sizeof(path), "%s.%d.trace", prefix, (int)getpid());
+  std::lock_guard<std::mutex> lk(g_trace_mu);
+  if (!start_locked(path))
+    return false;
+  std::strcpy(g_prefix, prefix);
+  return true;
+}
+
+int trace_stop() {
+  std::lock_guard<std::mutex> lk(g_trace_mu);
+  return stop_locked();
+}
+
+// fork: the file lock is a leaf like the profiler's
+void trace_lock() { g_trace_mu.lock(); }
+void trace_unlock() { g_trace_mu.unlock(); }
+
+// the child must not append to the parent's file. its other threads are
+// gone, so their buffers are free; an env-started trace carries on in a
+// file of the child's own.
+void trace_fork_child() {
+  for (uint32_t i = 0; i < g_buffers_committed; ++i)
+    if (&g_buffers[i] != t_trace.buf)
+      g_buffers[i].owned = false;
+  if (g_fd >= 0) {
+    g_trace_on.store(false, std::memory_order_relaxed);
+    close(g_fd);
+    g_fd = -1;
+    if (g_prefix[0] != '\0') {
+      char path[sizeof(g_prefix) + 32];
+      std::snprintf(path, sizeof(path), "%s.%d.trace", g_prefix, (int)getpid());
+      (void)start_locked(path);
+    }
+  }
+  g_trace_mu.unlock();
+}
+
+} // namespace zialloc::memory
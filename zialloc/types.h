@@ -12,21 +12,35 @@
 #define ZU(x)  x##ULL
 #define ZI(x)  x##LL
 
+#define TINY_PAGE_SHIFT     (16) // 64 kib
 #define SMALL_PAGE_SHIFT    (20) // 1 mib
 #define MEDIUM_PAGE_SHIFT   (23) // 8 mib
 #define LARGE_PAGE_SHIFT    (24) // 16 mib
 #define SEGMENT_SHIFT       (27) // 128 mib
+#define HUGE_PAGE_SHIFT     (21) // 2 mib, x86-64 THP
 
+#define TINY_PAGE_SIZE      (ZU(1)<<TINY_PAGE_SHIFT)
 #define SMALL_PAGE_SIZE     (ZU(1)<<SMALL_PAGE_SHIFT)
 #define MEDIUM_PAGE_SIZE    (ZU(1)<<MEDIUM_PAGE_SHIFT)
 #define LARGE_PAGE_SIZE     (ZU(1)<<LARGE_PAGE_SHIFT)
 
+#define HUGE_PAGE_SIZE      (ZU(1)<<HUGE_PAGE_SHIFT)
+
 #define SEGMENT_SIZE        (ZU(1)<<SEGMENT_SHIFT)
 #define SEGMENT_ALIGN       SEGMENT_SIZE
 #define SEGMENT_MASK        ((uintptr_t)(SEGMENT_ALIGN - 1))
 
 #define HEAP_RESERVED_DEFAULT (100ULL * GB)
 
+#define PURGE_DELAY_DEFAULT_MS   (1000)           // EMPTY pages idle this long get decommitted
+#define PURGE_RETAINED_DEFAULT   (256ULL * MB)     // idle EMPTY bytes kept before purging early
+
+#define PROFILE_INTERVAL_DEFAULT (512ULL * KB)     // mean allocated bytes between heap samples
+
+#define CACHE_LINE_SIZE     (64)
+
+#define NUMA_MAX_NODES      (8)   // nodes past this share the last node's pools
+
 #define MIN_ALIGNMENT       (64*KB)
 #define MAX_ALIGNMENT       LARGE_PAGE_SIZE
 
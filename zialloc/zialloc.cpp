@@ -1,177 +1,595 @@
+#include <algorithm>
 #include <array>
+#include <cerrno>
+#include <csignal>
 #include <cstddef>
 #include <cstdint>
 #include <atomic>
 #include <cstring>
-#include <deque>
-#include <memory>
 #include <mutex>
-#include <vector>
+#include <new>
+#include <pthread.h>
+#include <type_traits>
+#include <time.h>
 
 #include "types.h"
 #include "mem.h"
 #include "zialloc_memory.hpp"
+#include "zialloc_stats.h"
 
 namespace zialloc::memory {
 
 namespace {
 
-static std::atomic<bool> g_zero_on_free{false};
-static std::atomic<bool> g_uaf_check{false};
-
-static constexpr size_t PAGE_LOCK_STRIPES = 2048;
 static constexpr size_t MAX_QUEUE_PROBES_PER_ALLOC = 64;
-static constexpr size_t MAX_FALLBACK_SCANS_PER_ALLOC = 128;	// max segments that will be checked on slow path
-static std::array<std::mutex, PAGE_LOCK_STRIPES> g_page_locks;
 static thread_local size_t g_last_alloc_usable = 0;
-static std::atomic<uint32_t> g_live_threads{0};
+// leading bytes of the last block that may be non-zero (calloc clears only
+// these); SIZE_MAX when nothing is known
+static thread_local size_t g_last_alloc_dirty = SIZE_MAX;
+
+// purge policy: unowned EMPTY pages are decommitted once they have been idle
+// for the delay, or right away while idle EMPTY bytes exceed the budget.
+// passes are amortized into slow paths: every PURGE_CHECK_EVERY events a
+// thread reads the clock, and at most one pass per PURGE_INTERVAL_NS walks
+// the next PURGE_PAGES_PER_PASS pages.
+static std::atomic<uint64_t> g_purge_delay_ns{0};
+static std::atomic<size_t> g_purge_retained_budget{0};
+static std::atomic<size_t> g_retained_empty_bytes{0}; // stamped, not yet decommitted
+static constexpr uint32_t PURGE_CHECK_EVERY = 256;
+static constexpr uint64_t PURGE_INTERVAL_NS = 10000000ULL;
+static constexpr size_t PURGE_PAGES_PER_PASS = 64;
+static thread_local uint32_t g_purge_countdown = 0;
+
+// background maintenance (ZIALLOC_BACKGROUND): while the worker runs, purge
+// passes and XL cache decay happen on it instead of in slow paths
+static std::atomic<bool> g_background_active{false};
+static constexpr size_t BACKGROUND_PASSES_PER_TICK = 64;
+// raw pthread objects: nothing destroys them at exit while the worker may
+// still be waiting (nobody stops it under LD_PRELOAD), and a forked child
+// re-initializes the cv it inherited with the parent's waiter on it
+static pthread_mutex_t g_bg_mu = PTHREAD_MUTEX_INITIALIZER; // guards the worker state below
+static pthread_cond_t g_bg_cv = PTHREAD_COND_INITIALIZER;
+static bool g_bg_running = false;
+static bool g_bg_stop = false;
+static pthread_t g_bg_thread;
+static uint64_t g_bg_interval_ns = 0;
+static void (*g_bg_on_tick)(uint64_t now_ns) = nullptr;
+
+// alloc.cpp folds the exiting thread's stats batch in here
+static std::atomic<void (*)()> g_thread_exit_hook{nullptr};
+
+// numa: set by init from sysfs; 1 turns every node lookup into a constant.
+// threads re-read their cpu's node every NUMA_REFRESH_EVERY slow paths.
+static std::atomic<unsigned> g_numa_nodes{1};
+static constexpr uint32_t NUMA_REFRESH_EVERY = 64;
+
+// allocation-path counters (see zialloc_stats.h). each thread bumps its own
+// block with a relaxed load and store, no rmw; readers sum the live blocks
+// plus what exited threads folded into g_retired_counters.
+#ifdef ZIALLOC_NO_STATS
+static constexpr bool STATS_ENABLED = false;
+#else
+static constexpr bool STATS_ENABLED = true;
+#endif
+
+enum HeapCounter : size_t {
+#define ZIALLOC_COUNTER_ENUM(name) COUNTER_##name,
+  ZIALLOC_COUNTERS(ZIALLOC_COUNTER_ENUM)
+#undef ZIALLOC_COUNTER_ENUM
+  COUNTER_COUNT
+};
 
-static inline page_kind_t class_for_size(size_t size) {
-  if (size <= CHUNK_SM)
-    return PAGE_SM;
-  if (size <= CHUNK_MD)
-    return PAGE_MED;
-  if (size <= CHUNK_LG)
-    return PAGE_LG;
-  return PAGE_XL;
+struct CounterBlock {
+  std::atomic<uint64_t> v[COUNTER_COUNT] = {};
+  CounterBlock *prev = nullptr;
+  CounterBlock *next = nullptr;
+  bool linked = false;
+};
+
+// constant-initialized with a trivial destructor: no tls guard on access
+static thread_local CounterBlock t_counters;
+static std::mutex g_counter_mu; // guards the block list and the retired totals
+static CounterBlock *g_counter_head = nullptr;
+static uint64_t g_retired_counters[COUNTER_COUNT];
+
+static inline void stat_add(HeapCounter c, uint64_t n = 1) {
+  if constexpr (STATS_ENABLED) {
+    std::atomic<uint64_t> &v = t_counters.v[c];
+    v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+}
+
+// takes `mu`, counting the times another thread already held it
+static inline std::unique_lock<std::mutex> lock_counted(std::mutex &mu) {
+  if constexpr (STATS_ENABLED) {
+    std::unique_lock<std::mutex> lk(mu, std::try_to_lock);
+    if (!lk.owns_lock()) {
+      stat_add(COUNTER_lock_contended);
+      lk.lock();
+    }
+    return lk;
+  } else {
+    return std::unique_lock<std::mutex>(mu);
+  }
+}
+
+static void counters_attach() {
+  if constexpr (STATS_ENABLED) {
+    CounterBlock *b = &t_counters;
+    std::lock_guard<std::mutex> lk(g_counter_mu);
+    if (b->linked)
+      return;
+    b->prev = nullptr;
+    b->next = g_counter_head;
+    if (g_counter_head)
+      g_counter_head->prev = b;
+    g_counter_head = b;
+    b->linked = true;
+  }
+}
+
+// thread exit: fold the block into the retired totals before its tls goes
+static void counters_detach() {
+  if constexpr (STATS_ENABLED) {
+    CounterBlock *b = &t_counters;
+    std::lock_guard<std::mutex> lk(g_counter_mu);
+    if (!b->linked)
+      return;
+    for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+      g_retired_counters[i] += b->v[i].load(std::memory_order_relaxed);
+      b->v[i].store(0, std::memory_order_relaxed);
+    }
+    if (b->prev)
+      b->prev->next = b->next;
+    else
+      g_counter_head = b->next;
+    if (b->next)
+      b->next->prev = b->prev;
+    b->linked = false;
+  }
 }
 
 static inline size_t page_size_for_kind(page_kind_t kind) {
   return page_kind_size(kind);
 }
 
-static inline size_t ceil_pow2_at_least_16(size_t n) {
-  if (n <= 16)
-    return 16;
-  const size_t x = n - 1;
-  const unsigned lz =
-      static_cast<unsigned>(__builtin_clzll(static_cast<unsigned long long>(x)));
-  const unsigned shift = 64U - lz;
-  return static_cast<size_t>(1ULL << shift);
+// size classes: 16b spacing up to 128b, then 4 classes per doubling so the
+// worst-case internal waste is 25%. classes run up to LARGE_PAGE_SIZE so the
+// large-page reroute of CHUNK_LG < size <= LARGE_PAGE_SIZE has a home.
+static constexpr size_t SIZE_CLASS_LINEAR_STEP = 16;
+static constexpr size_t SIZE_CLASS_LINEAR_COUNT = 8; // 16..128
+static constexpr unsigned SIZE_CLASS_GROUP_SHIFT = 7; // first doubling group is (128, 256]
+static constexpr size_t SIZE_CLASS_STEPS_PER_DOUBLING = 4;
+static constexpr size_t NUM_SIZE_CLASSES =
+    SIZE_CLASS_LINEAR_COUNT +
+    (LARGE_PAGE_SHIFT - SIZE_CLASS_GROUP_SHIFT) * SIZE_CLASS_STEPS_PER_DOUBLING;
+static constexpr size_t SIZE_CLASS_LUT_MAX = 1024; // direct lookup up to here
+
+struct SizeClassInfo {
+  size_t stride;
+  page_kind_t kind;
+};
+
+static constexpr page_kind_t kind_for_stride(size_t stride) {
+  // keep >= ~2 chunks per page; strides above CHUNK_LG are the 1-per-page
+  // large-page reroute. the magazine classes get 64KiB tiny pages, so a
+  // thread's partial tiny pages cost 64KiB apiece rather than 1MiB
+  return stride <= static_cast<size_t>(CHUNK_TINY) ? PAGE_TINY
+         : stride <= static_cast<size_t>(CHUNK_SM) ? PAGE_SM
+         : stride <= static_cast<size_t>(CHUNK_MD) ? PAGE_MED
+                                                   : PAGE_LG;
+}
+
+static constexpr std::array<SizeClassInfo, NUM_SIZE_CLASSES> make_size_classes() {
+  std::array<SizeClassInfo, NUM_SIZE_CLASSES> table{};
+  size_t idx = 0;
+  for (size_t i = 1; i <= SIZE_CLASS_LINEAR_COUNT; ++i, ++idx) {
+    const size_t stride = i * SIZE_CLASS_LINEAR_STEP;
+    table[idx] = {stride, kind_for_stride(stride)};
+  }
+  for (unsigned k = SIZE_CLASS_GROUP_SHIFT; k < LARGE_PAGE_SHIFT; ++k) {
+    const size_t group = ZU(1) << k;
+    const size_t step = group / SIZE_CLASS_STEPS_PER_DOUBLING;
+    for (size_t j = 1; j <= SIZE_CLASS_STEPS_PER_DOUBLING; ++j, ++idx) {
+      const size_t stride = group + j * step;
+      table[idx] = {stride, kind_for_stride(stride)};
+    }
+  }
+  return table;
+}
+
+static constexpr std::array<SizeClassInfo, NUM_SIZE_CLASSES> SIZE_CLASSES = make_size_classes();
+
+static constexpr std::array<uint8_t, SIZE_CLASS_LUT_MAX / SIZE_CLASS_LINEAR_STEP + 1>
+make_size_class_lut() {
+  std::array<uint8_t, SIZE_CLASS_LUT_MAX / SIZE_CLASS_LINEAR_STEP + 1> lut{};
+  size_t cls = 0;
+  for (size_t i = 0; i < lut.size(); ++i) {
+    const size_t size = i * SIZE_CLASS_LINEAR_STEP;
+    while (SIZE_CLASSES[cls].stride < size)
+      cls++;
+    lut[i] = static_cast<uint8_t>(cls);
+  }
+  return lut;
 }
 
-static inline size_t norm_chunk_req(page_kind_t kind, size_t req) {
-  // bucket classed allocations to reduce mixed-size fragmentation scans
-  if (kind != PAGE_SM && kind != PAGE_MED && kind != PAGE_LG)
-    return align_up(req, 16);
-  size_t norm = ceil_pow2_at_least_16(req);
-  const size_t cap = (kind == PAGE_SM)
-                         ? static_cast<size_t>(CHUNK_SM)
-                         : (kind == PAGE_MED) ? static_cast<size_t>(CHUNK_MD)
-                                              : static_cast<size_t>(CHUNK_LG);
-  if (norm > cap)
-    norm = cap;
-  return align_up(norm, 16);
+static constexpr auto SIZE_CLASS_LUT = make_size_class_lut();
+
+static_assert(SIZE_CLASSES[NUM_SIZE_CLASSES - 1].stride == LARGE_PAGE_SIZE,
+              "size classes must end at the large page size");
+static_assert(NUM_SIZE_CLASSES <= UINT8_MAX, "size class lut stores uint8_t");
+
+// size (1..LARGE_PAGE_SIZE) -> class index
+static inline size_t size_class_for(size_t size) {
+  if (size <= SIZE_CLASS_LUT_MAX)
+    return SIZE_CLASS_LUT[(size + SIZE_CLASS_LINEAR_STEP - 1) / SIZE_CLASS_LINEAR_STEP];
+  // (2^k, 2^(k+1)] is split in 4: the two bits under the leading one pick it
+  const size_t x = size - 1;
+  const unsigned k = 63U - static_cast<unsigned>(
+                               __builtin_clzll(static_cast<unsigned long long>(x)));
+  const size_t sub = (x >> (k - 2)) & (SIZE_CLASS_STEPS_PER_DOUBLING - 1);
+  return SIZE_CLASS_LINEAR_COUNT +
+         static_cast<size_t>(k - SIZE_CLASS_GROUP_SHIFT) * SIZE_CLASS_STEPS_PER_DOUBLING + sub;
 }
 
-static inline std::mutex &page_lock_for(const void *page_like_ptr) {
-  const uintptr_t key = reinterpret_cast<uintptr_t>(page_like_ptr) >> 4;
-  return g_page_locks[key % PAGE_LOCK_STRIPES];
+static inline page_kind_t class_for_size(size_t size) {
+  if (size > LARGE_PAGE_SIZE)
+    return PAGE_XL;
+  return SIZE_CLASSES[size_class_for(size)].kind;
 }
 
+static constexpr size_t NUM_PAGE_KINDS = PAGE_XL; // kinds that live in segments
+
 static inline size_t class_index_for_kind(page_kind_t kind) {
   return static_cast<size_t>(kind);
 }
 
+// per-thread magazines (tcache) cover the fine-grained classes only: a LIFO
+// of chunk pointers per class, at most TCACHE_CLASS_BYTES (and TCACHE_SLOTS
+// entries) per class and TCACHE_MAX_BYTES per thread
+static constexpr size_t TCACHE_MAX_STRIDE = 1024;
+static constexpr size_t TCACHE_CLASSES = SIZE_CLASS_LUT[TCACHE_MAX_STRIDE / SIZE_CLASS_LINEAR_STEP] + 1;
+static constexpr uint32_t TCACHE_SLOTS = 64;
+static constexpr size_t TCACHE_CLASS_BYTES = 16 * KB;
+static constexpr size_t TCACHE_MAX_BYTES = 256 * KB;
+static constexpr uintptr_t TCACHE_ZERO_TAG = 1; // low bit of an entry: chunk is all zero
+
+static_assert(SIZE_CLASSES[TCACHE_CLASSES - 1].stride == TCACHE_MAX_STRIDE,
+              "tcache must end on a class boundary");
+static_assert(TCACHE_MAX_STRIDE == static_cast<size_t>(CHUNK_TINY),
+              "the magazine classes are the tiny classes");
+
+// page bitmaps are inline and sized for the densest class: 16B slots on a
+// tiny page, 4096 bits. the summary has one bit per bitmap word.
+static constexpr size_t max_chunks_per_page() {
+  size_t most = 0;
+  for (const SizeClassInfo &info : SIZE_CLASSES) {
+    const size_t chunks = page_kind_size(info.kind) / info.stride;
+    most = chunks > most ? chunks : most;
+  }
+  return most;
+}
+static constexpr size_t PAGE_BITMAP_WORDS = (max_chunks_per_page() + 63) / 64;
+static constexpr size_t PAGE_SUMMARY_WORDS = (PAGE_BITMAP_WORDS + 63) / 64;
+
+static constexpr uint32_t tcache_cap_for(size_t cls) {
+  const size_t by_bytes = TCACHE_CLASS_BYTES / SIZE_CLASSES[cls].stride;
+  return by_bytes < TCACHE_SLOTS ? static_cast<uint32_t>(by_bytes) : TCACHE_SLOTS;
+}
+
 class Page;
 class Segment;
+class UserHeap;
 
 static constexpr uint64_t XL_MAGIC = 0x584C4F43484B4559ULL; // "XLOCHKEY"
 
-struct XLHeader {
+// alignas keeps the block after the header 16-byte aligned
+struct alignas(16) XLHeader {
   uint64_t 	magic;
   size_t 		mapping_size;
   size_t 		usable_size;
-  uint64_t 	reserved;
+  uint64_t 	offset;       // mapping start -> header, nonzero for aligned blocks
+  UserHeap 	*heap;        // owning zialloc heap, nullptr for plain malloc
+  XLHeader 	*heap_prev;   // heap's block list, touched only by the heap's user
+  XLHeader 	*heap_next;
+  uint32_t 	heap_released; // free()d from outside; unmapped when the heap lets go
 };
 
-class DeferredRing {
+static inline size_t xl_map_size_for(size_t size) {
+  return align_up(align_up(size, 16) + sizeof(XLHeader), 4096);
+}
+
+// direct map from p >> SEGMENT_SHIFT to whatever owns that granule: a
+// Segment*, or an XLHeader* tagged with MAP_TAG_XL. segments and XL mappings
+// are SEGMENT_ALIGN aligned so a granule never has two owners. the table is
+// zeroed bss, so only granules that get registered ever fault memory in.
+static constexpr unsigned MAP_ADDRESS_BITS = 48;
+static constexpr size_t MAP_ENTRIES = ZU(1) << (MAP_ADDRESS_BITS - SEGMENT_SHIFT);
+static constexpr uintptr_t MAP_TAG_XL = 1;
+static std::array<std::atomic<uintptr_t>, MAP_ENTRIES> g_segment_map;
+
+static inline void segment_map_set(void *base, size_t size, uintptr_t value) {
+  const uintptr_t b = reinterpret_cast<uintptr_t>(base);
+  const size_t first = static_cast<size_t>(b >> SEGMENT_SHIFT);
+  const size_t last = static_cast<size_t>((b + size - 1) >> SEGMENT_SHIFT);
+  for (size_t i = first; i <= last && i < MAP_ENTRIES; ++i)
+    g_segment_map[i].store(value, std::memory_order_release);
+}
+
+static inline uintptr_t segment_map_get(const void *ptr) {
+  const size_t key = static_cast<size_t>(reinterpret_cast<uintptr_t>(ptr) >> SEGMENT_SHIFT);
+  if (key >= MAP_ENTRIES)
+    return 0;
+  return g_segment_map[key].load(std::memory_order_acquire);
+}
+
+// XL header for a user pointer, or nullptr if `ptr` is not an XL block start
+static inline XLHeader *xl_header_for(void *ptr) {
+  const uintptr_t entry = segment_map_get(ptr);
+  if ((entry & MAP_TAG_XL) == 0)
+    return nullptr;
+  auto *hdr = reinterpret_cast<XLHeader *>(entry & ~MAP_TAG_XL);
+  if (static_cast<void *>(reinterpret_cast<char *>(hdr) + sizeof(XLHeader)) != ptr)
+    return nullptr;
+  return hdr;
+}
+
+// recently freed XL mappings stay mapped here so a similar-sized request
+// skips the mmap/munmap pair, and the page faults too while the span is still
+// committed. spans are bucketed by ceil(log2(size)), so reusing any span in a
+// request's bucket wastes less than 2x. spans idle for XL_CACHE_DECAY_NS get
+// their physical pages dropped (MADV_DONTNEED); past XL_CACHE_UNMAP_NS, or
+// when committed spans would exceed XL_CACHE_MAX_BYTES, they are unmapped.
+static constexpr unsigned XL_CACHE_MIN_SHIFT = 25;          // bucket 0: (16MiB, 32MiB]
+static constexpr size_t XL_CACHE_BUCKETS = 6;               // last: (512MiB, 1GiB]
+static constexpr size_t XL_CACHE_SLOTS = 4;
+static constexpr size_t XL_CACHE_MAX_BYTES = ZU(1) << 30;
+static constexpr uint64_t XL_CACHE_DECAY_NS = 1000000000ULL;
+static constexpr uint64_t XL_CACHE_UNMAP_NS = 10 * XL_CACHE_DECAY_NS;
+
+static inline uint64_t monotonic_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL +
+         static_cast<uint64_t>(ts.tv_nsec);
+}
+
+class XLSpanCache {
 private:
-  static constexpr uint32_t CAP = 256;
-  static constexpr uint32_t MASK = CAP - 1;
+  struct Span {
+    void 			*base;
+    size_t 		size;
+    uint64_t 	cached_ns;
+    bool 			committed;
+  };
 
-  struct Cell {
-    std::atomic<uint32_t> seq;
-    void *data;
+  // spans pulled out under the lock, unmapped after it is dropped
+  struct EvictList {
+    std::array<Span, XL_CACHE_BUCKETS * XL_CACHE_SLOTS + 1> spans{};
+    size_t count = 0;
+
+    void add(const Span &s) { spans[count++] = s; }
+    void release() {
+      for (size_t i = 0; i < count; ++i)
+        free_segment(spans[i].base, spans[i].size);
+      count = 0;
+    }
   };
 
-  std::array<Cell, CAP> cells;
-  std::atomic<uint32_t> head;
-  std::atomic<uint32_t> tail;
+  std::mutex mu;
+  std::array<std::array<Span, XL_CACHE_SLOTS>, XL_CACHE_BUCKETS> buckets{};
+  size_t committed_bytes = 0;
 
-public:
-  DeferredRing() : cells(), head(0), tail(0) {
-    for (uint32_t i = 0; i < CAP; ++i) {
-      cells[i].seq.store(i, std::memory_order_relaxed);
-      cells[i].data = nullptr;
+  static bool bucket_for(size_t size, size_t *out) {
+    if (size > XL_CACHE_MAX_BYTES)
+      return false;
+    unsigned shift = 64U - static_cast<unsigned>(
+                               __builtin_clzll(static_cast<unsigned long long>(size - 1)));
+    if (shift < XL_CACHE_MIN_SHIFT)
+      shift = XL_CACHE_MIN_SHIFT;
+    *out = shift - XL_CACHE_MIN_SHIFT;
+    return *out < XL_CACHE_BUCKETS;
+  }
+
+  void drop_locked(Span &s, EvictList &ev) {
+    if (s.committed)
+      committed_bytes -= s.size;
+    ev.add(s);
+    s = Span{};
+  }
+
+  void decay_locked(uint64_t now, EvictList &ev) {
+    for (auto &bucket : buckets) {
+      for (Span &s : bucket) {
+        if (!s.base)
+          continue;
+        const uint64_t idle = now - s.cached_ns;
+        if (idle >= XL_CACHE_UNMAP_NS) {
+          drop_locked(s, ev);
+        } else if (s.committed && idle >= XL_CACHE_DECAY_NS) {
+          decommit_pages(s.base, s.size);
+          s.committed = false;
+          committed_bytes -= s.size;
+        }
+      }
     }
   }
 
-  bool push(void *ptr) {
-    uint32_t pos = head.load(std::memory_order_relaxed);
-    for (;;) {
-      Cell &cell = cells[pos & MASK];
-      const uint32_t seq = cell.seq.load(std::memory_order_acquire);
-      const intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
-      if (diff == 0) {
-        if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed,
-                                       std::memory_order_relaxed)) {
-          cell.data = ptr;
-          cell.seq.store(pos + 1, std::memory_order_release);
-          return true;
+  bool evict_oldest_committed_locked(EvictList &ev) {
+    Span *oldest = nullptr;
+    for (auto &bucket : buckets) {
+      for (Span &s : bucket) {
+        if (s.base && s.committed && (!oldest || s.cached_ns < oldest->cached_ns))
+          oldest = &s;
+      }
+    }
+    if (!oldest)
+      return false;
+    drop_locked(*oldest, ev);
+    return true;
+  }
+
+public:
+  // hand a whole XL mapping to the cache; false means the caller unmaps it
+  bool put(void *span_base, size_t size) {
+    size_t b = 0;
+    if (!span_base || !bucket_for(size, &b))
+      return false;
+
+    EvictList ev;
+    {
+      std::lock_guard<std::mutex> lk(mu);
+      const uint64_t now = monotonic_ns();
+      decay_locked(now, ev);
+      while (committed_bytes + size > XL_CACHE_MAX_BYTES &&
+             evict_oldest_committed_locked(ev)) {
+      }
+
+      Span *slot = nullptr;
+      for (Span &s : buckets[b]) {
+        if (!s.base) {
+          slot = &s;
+          break;
         }
-      } else if (diff < 0) {
-        return false;
-      } else {
-        pos = head.load(std::memory_order_relaxed);
+        if (!slot || s.cached_ns < slot->cached_ns)
+          slot = &s;
       }
+      if (slot->base)
+        drop_locked(*slot, ev);
+      *slot = Span{span_base, size, now, true};
+      committed_bytes += size;
     }
+    ev.release();
+    return true;
   }
 
-  bool pop(void **out) {
-    uint32_t pos = tail.load(std::memory_order_relaxed);
-    for (;;) {
-      Cell &cell = cells[pos & MASK];
-      const uint32_t seq = cell.seq.load(std::memory_order_acquire);
-      const intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
-      if (dif == 0) {
-        if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed,
-                                       std::memory_order_relaxed)) {
-          *out = cell.data;
-          cell.seq.store(pos + CAP, std::memory_order_release);
-          return true;
+  // best-fit span of at least `size` bytes from the request's bucket
+  // `zeroed_out` is true when the span was decommitted while cached, so the
+  // kernel hands back zero pages
+  void *take(size_t size, size_t *span_size_out, bool *zeroed_out) {
+    size_t b = 0;
+    if (!bucket_for(size, &b))
+      return nullptr;
+
+    EvictList ev;
+    void *out = nullptr;
+    {
+      std::lock_guard<std::mutex> lk(mu);
+      decay_locked(monotonic_ns(), ev);
+      Span *best = nullptr;
+      for (Span &s : buckets[b]) {
+        if (s.base && s.size >= size && (!best || s.size < best->size))
+          best = &s;
+      }
+      if (best) {
+        out = best->base;
+        *span_size_out = best->size;
+        *zeroed_out = !best->committed;
+        if (best->committed)
+          committed_bytes -= best->size;
+        *best = Span{};
+      }
+    }
+    ev.release();
+    return out;
+  }
+
+  void flush() {
+    EvictList ev;
+    {
+      std::lock_guard<std::mutex> lk(mu);
+      for (auto &bucket : buckets) {
+        for (Span &s : bucket) {
+          if (s.base)
+            drop_locked(s, ev);
         }
-      } else if (dif < 0) {
-        return false;
-      } else {
-        pos = tail.load(std::memory_order_relaxed);
       }
     }
+    ev.release();
   }
 
-  size_t approx_size() const {
-    const uint32_t h = head.load(std::memory_order_relaxed);
-    const uint32_t t = tail.load(std::memory_order_relaxed);
-    return static_cast<size_t>(h - t);
+  // background ticks: decay without waiting for the next put or take
+  void decay(uint64_t now) {
+    EvictList ev;
+    {
+      std::lock_guard<std::mutex> lk(mu);
+      decay_locked(now, ev);
+    }
+    ev.release();
   }
+
+  // fork: held across the fork so the child never inherits it mid-update
+  void lock() { mu.lock(); }
+  void unlock() { mu.unlock(); }
 };
 
-class Page {
+// links for the intrusive chunk lists live in the first word of a free chunk
+static inline void *chunk_next(void *chunk) { return *static_cast<void **>(chunk); }
+static inline void set_chunk_next(void *chunk, void *next) {
+  *static_cast<void **>(chunk) = next;
+}
+
+// owner ids: what a page's `owner_tid` holds. a thread's id comes from a
+// counter when its cache is built, not from gettid: a tid is reused once its
+// thread exits (and a dead parent thread's tid can turn up again in a forked
+// child), while a counter id is only reused after 2^31 threads. heaps count
+// down from -1 instead; 0 means unowned.
+using owner_id_t = int32_t;
+
+static std::atomic<uint32_t> g_next_thread_id{0};
+
+static owner_id_t next_thread_id() {
+  const owner_id_t id = static_cast<owner_id_t>(
+      (g_next_thread_id.fetch_add(1, std::memory_order_relaxed) + 1) & 0x7FFFFFFFu);
+  return id != 0 ? id : 1;
+}
+
+// Page state is owner-exclusive: only the thread whose id is in `owner_tid`
+// touches the bitmap, counters and `local_free`, so none of it needs a lock.
+// Other threads hand chunks back through `thread_free`, an intrusive MPSC list
+// threaded through the freed chunks themselves, and the owner steals it in one
+// exchange. Unowned pages are taken with a CAS on `owner_tid`.
+//
+// Pages live in the metadata arena, cache-line aligned. Fields are grouped by
+// who writes them: the owner's hot line, the line remote threads CAS on, and
+// cold geometry/bookkeeping, so remote frees never bounce the owner's line.
+class alignas(CACHE_LINE_SIZE) Page {
 private:
-  Segment *owner_segment;
-  size_t owner_segment_idx;
+  // owner-hot: every owner alloc/free
+  void *local_free;               // owner frees, reused LIFO before any bitmap scan
   void *base;
-  page_kind_t size_class;
-  size_t page_span;
   size_t chunk_usable;
   uint32_t capacity;
   uint32_t used;
   uint32_t first_hint;
-  pid_t owner_tid;
+  uint32_t bitmap_words;          // words of used_bitmap this geometry uses
   page_status_t status;
+  std::atomic<owner_id_t> owner_tid; // read by every free, written on claim/release
+  size_t zero_above;              // bytes past this offset were never written
+  bool frees_scrubbed;            // every free below zero_above went through zero-on-free
   bool initialized;
-  std::vector<uint64_t> used_bitmap;
-  DeferredRing deferred_frees;
+  bool decommitted;               // no physical memory behind the chunks
+  bool bumping;                   // fresh page: slots go out in order, bits unset
+  uint32_t bump_top;              // while bumping: slots below are live, bits unset
+
+  // remote-hot: pushed by any thread
+  alignas(CACHE_LINE_SIZE) std::atomic<void *> thread_free;
+  std::atomic<bool> queued_non_full;
+  std::atomic<Page *> queue_next; // class queue link
+
+  // cold
+  alignas(CACHE_LINE_SIZE) Segment *owner_segment;
+  size_t owner_segment_idx;
+  page_kind_t size_class;
+  size_t class_idx;               // relaxed atomic: queueing reads it off unowned pages
+  size_t page_span;
+  uint64_t empty_since_ns;        // when a purge pass first saw it EMPTY, 0 if not
+  Page *heap_next;                // retired-page list of the heap that owns it
+  // bit w set: used_bitmap[w] has a clear bit. owner only, like `used`.
+  uint64_t free_summary[PAGE_SUMMARY_WORDS];
+  // bits past `capacity` in the last word stay set, so a word with a clear
+  // bit always has a real free slot in it
+  uint64_t used_bitmap[PAGE_BITMAP_WORDS];
 
   void *slot_ptr(uint32_t slot) const {
     return static_cast<void *>(static_cast<char *>(base) +
@@ -184,7 +602,7 @@ private:
     const uintptr_t p = reinterpret_cast<uintptr_t>(ptr);
     const uintptr_t b = reinterpret_cast<uintptr_t>(base);
 
-    PTR_IN_BOUNDS(b < p, "Chunk pointer points before owning page..."); // if(p < b) => bad bad bad
+    PTR_IN_BOUNDS(b <= p, "Chunk pointer points before owning page..."); // if(p < b) => bad bad bad
 
     const size_t offset = static_cast<size_t>(p - b);
     if ((offset % chunk_usable) != 0) // should be aligned at this point
@@ -196,91 +614,210 @@ private:
     return true;
   }
 
+  // bitmap words are only written by the owner, but remote frees read them to
+  // catch double frees, so every access is a relaxed atomic (plain mov)
   bool bit_is_set(uint32_t idx) const {
     const uint32_t word = idx >> 6;
     const uint32_t bit = idx & 63U;
-    return (used_bitmap[word] & (1ULL << bit)) != 0;
+    return (__atomic_load_n(&used_bitmap[word], __ATOMIC_RELAXED) & (1ULL << bit)) != 0;
   }
 
   void bit_set(uint32_t idx) {
     const uint32_t word = idx >> 6;
     const uint32_t bit = idx & 63U;
-    used_bitmap[word] |= (1ULL << bit);
+    const uint64_t next = __atomic_load_n(&used_bitmap[word], __ATOMIC_RELAXED) | (1ULL << bit);
+    __atomic_store_n(&used_bitmap[word], next, __ATOMIC_RELAXED);
+    if (next == ~0ULL)
+      free_summary[word >> 6] &= ~(1ULL << (word & 63U));
   }
 
   void bit_clear(uint32_t idx) {
     const uint32_t word = idx >> 6;
     const uint32_t bit = idx & 63U;
-    used_bitmap[word] &= ~(1ULL << bit);
+    const uint64_t cur = __atomic_load_n(&used_bitmap[word], __ATOMIC_RELAXED);
+    __atomic_store_n(&used_bitmap[word], cur & ~(1ULL << bit), __ATOMIC_RELAXED);
+    if (cur == ~0ULL)
+      free_summary[word >> 6] |= 1ULL << (word & 63U);
   }
 
+  // live by the bitmap or by sitting below the bump cursor. remote frees
+  // check this too: the acquire pairs with end_bump's release, so a reader
+  // that sees the cursor dropped also sees the bits it was replaced with
+  bool slot_live(uint32_t slot) const {
+    return slot < __atomic_load_n(&bump_top, __ATOMIC_ACQUIRE) || bit_is_set(slot);
+  }
 
-  void drain_deferred_locked(size_t max_to_drain) { 
-    size_t drained = 0;
-    void *deferred_ptr = nullptr;
-    while (drained < max_to_drain && deferred_frees.pop(&deferred_ptr)) {
-      page_status_t before = EMPTY;
-      page_status_t after = EMPTY;
-      (void)free_local(deferred_ptr, nullptr, &before, &after);
-      drained++;
+  // leave bump mode: set the bits of every bumped slot in whole words, then
+  // drop the cursor. the bitmap path takes over from bump_top onwards
+  void end_bump() {
+    const uint32_t top = bump_top;
+    const uint32_t full_words = top >> 6;
+    for (uint32_t w = 0; w < full_words; ++w) {
+      __atomic_store_n(&used_bitmap[w], ~0ULL, __ATOMIC_RELAXED);
+      free_summary[w >> 6] &= ~(1ULL << (w & 63U));
     }
+    if ((top & 63U) != 0) {
+      const uint64_t next =
+          __atomic_load_n(&used_bitmap[full_words], __ATOMIC_RELAXED) | ~(~0ULL << (top & 63U));
+      __atomic_store_n(&used_bitmap[full_words], next, __ATOMIC_RELAXED);
+      if (next == ~0ULL)
+        free_summary[full_words >> 6] &= ~(1ULL << (full_words & 63U));
+    }
+    first_hint = top < capacity ? top : 0;
+    bumping = false;
+    __atomic_store_n(&bump_top, 0U, __ATOMIC_RELEASE);
+  }
+
+  // first bitmap word with a free slot at or after `from`, wrapping around;
+  // UINT32_MAX if the page is full. at most PAGE_SUMMARY_WORDS + 1 loads.
+  uint32_t next_free_word(uint32_t from) const {
+    const uint32_t summary_words = (bitmap_words + 63U) / 64U;
+    uint32_t s = from >> 6;
+    uint64_t bits = free_summary[s] & (~0ULL << (from & 63U));
+    for (uint32_t step = 0; step <= summary_words; ++step) {
+      if (bits != 0ULL)
+        return (s << 6) + static_cast<uint32_t>(__builtin_ctzll(bits));
+      s = (s + 1) % summary_words;
+      bits = free_summary[s];
+    }
+    return UINT32_MAX;
+  }
+
+  // `mark` is false for bumped slots, whose bits are set by end_bump
+  void *take_slot(uint32_t slot, bool mark = true) {
+    // a slot past the watermark is untouched OS memory. below it, a slot is
+    // still zero if every free was scrubbed: its list link is nulled on pop
+    const size_t start = static_cast<size_t>(slot) * chunk_usable;
+    g_last_alloc_dirty = (start >= zero_above || frees_scrubbed) ? 0 : chunk_usable;
+    if (start + chunk_usable > zero_above)
+      zero_above = start + chunk_usable;
+    if (used == 0) {
+      if (empty_since_ns != 0) {
+        g_retained_empty_bytes.fetch_sub(page_span, std::memory_order_relaxed);
+        empty_since_ns = 0;
+      }
+      decommitted = false; // touching the chunk faults fresh memory back in
+    }
+    if (mark)
+      bit_set(slot);
+    used++;
+    status = (used == capacity) ? FULL : ACTIVE;
+    return slot_ptr(slot);
+  }
+
+  // publish an already-linked chain head..tail in one CAS
+  void push_thread_free(void *head, void *tail) {
+    void *old = thread_free.load(std::memory_order_relaxed);
+    do {
+      set_chunk_next(tail, old);
+    } while (!thread_free.compare_exchange_weak(old, head, std::memory_order_seq_cst,
+                                                std::memory_order_relaxed));
   }
 
 public:
+  // all zero, so the arena's fresh zero pages already are untouched pages.
+  // the fields that only mean something once the page is used (the scrubbed
+  // and decommitted flags, the owning segment) are set on first init.
   Page()
-      : owner_segment(nullptr), owner_segment_idx(0), base(nullptr), size_class(PAGE_SM),
-        page_span(0), chunk_usable(0), capacity(0), used(0),
-        first_hint(0), owner_tid(0), status(EMPTY), initialized(false), used_bitmap(),
-        deferred_frees() {}
+      : local_free(nullptr), base(nullptr), chunk_usable(0), capacity(0), used(0),
+        first_hint(0), bitmap_words(0), status(EMPTY), owner_tid(0), zero_above(0),
+        frees_scrubbed(false), initialized(false), decommitted(false), bumping(false),
+        bump_top(0), thread_free(nullptr),
+        queued_non_full(false), queue_next(nullptr), owner_segment(nullptr),
+        owner_segment_idx(0), size_class(PAGE_TINY), class_idx(0), page_span(0),
+        empty_since_ns(0), heap_next(nullptr) {}
 
   void set_owner_segment(Segment *seg, size_t seg_idx) {
     owner_segment = seg;
     owner_segment_idx = seg_idx;
   }
 
-  bool init(void *page_base, page_kind_t kind, size_t req_sz) {
-    if (!page_base || req_sz == 0)
+  bool init(void *page_base, page_kind_t kind, size_t cls) {
+    if (!page_base || cls >= NUM_SIZE_CLASSES || SIZE_CLASSES[cls].kind != kind)
       return false;
 
     const size_t span = page_size_for_kind(kind);
-    const size_t stride = norm_chunk_req(kind, req_sz);
-    if (stride == 0)
-      return false;
+    const size_t stride = SIZE_CLASSES[cls].stride;
     const size_t cap = span / stride;
-    if (cap == 0 || cap > UINT32_MAX)
+    if (cap == 0 || cap > PAGE_BITMAP_WORDS * 64)
       return false;
 
+    if (!initialized) {
+      // first use: nothing has touched the memory behind the page yet
+      frees_scrubbed = true;
+      decommitted = true;
+    }
     base = page_base;
     size_class = kind;
+    __atomic_store_n(&class_idx, cls, __ATOMIC_RELAXED);
     page_span = span;
     chunk_usable = stride;
     capacity = static_cast<uint32_t>(cap);
     used = 0;
     first_hint = 0;
-    owner_tid = 0;
     status = EMPTY;
+    local_free = nullptr;
     initialized = true;
-
-    used_bitmap.assign((capacity + 63U) / 64U, 0);
+    bumping = true;
+    __atomic_store_n(&bump_top, 0U, __ATOMIC_RELAXED);
+    // old chunks (and the list links just dropped) may sit anywhere below the
+    // watermark in the new geometry
+    if (zero_above != 0)
+      frees_scrubbed = false;
+
+    bitmap_words = (capacity + 63U) / 64U;
+    std::memset(used_bitmap, 0, bitmap_words * sizeof(used_bitmap[0]));
+    if ((capacity & 63U) != 0)
+      used_bitmap[bitmap_words - 1] = ~0ULL << (capacity & 63U);
+    std::memset(free_summary, 0, sizeof(free_summary));
+    for (uint32_t w = 0; w < bitmap_words; w += 64) {
+      const uint32_t n = (bitmap_words - w < 64) ? bitmap_words - w : 64;
+      free_summary[w >> 6] = (n == 64) ? ~0ULL : ((1ULL << n) - 1);
+    }
     return true;
   }
 
-  bool retune_if_empty(size_t req_sz) {
+  bool retune_if_empty(size_t cls) {
     if (!initialized)
       return false;
     if (used != 0)
       return false;
-    if (req_sz == 0)
-      return false;
-    // keep same page base and class - only retune chunk geometry(size)
-    return init(base, size_class, req_sz);
+    // keep same page base and kind - only retune chunk geometry(size)
+    return init(base, size_class, cls);
+  }
+
+  bool try_mark_enqueued() {
+    bool expected = false;
+    return queued_non_full.compare_exchange_strong(
+        expected, true, std::memory_order_acq_rel, std::memory_order_relaxed);
+  }
+
+  void clear_enqueued() { queued_non_full.store(false, std::memory_order_release); }
+
+  Page *get_queue_next() const { return queue_next.load(std::memory_order_relaxed); }
+  void set_queue_next(Page *next) { queue_next.store(next, std::memory_order_relaxed); }
+
+  Page *get_heap_next() const { return heap_next; }
+  void set_heap_next(Page *next) { heap_next = next; }
+
+  bool try_claim(owner_id_t tid) {
+    owner_id_t expected = 0;
+    return owner_tid.compare_exchange_strong(expected, tid, std::memory_order_acquire,
+                                             std::memory_order_relaxed);
   }
 
+  // owner gives the page up; nothing but atomics may be touched afterwards
+  void release() { owner_tid.store(0, std::memory_order_seq_cst); }
+
   bool is_initialized() const { return initialized; }
   bool can_hold(size_t req) const { return initialized && req <= chunk_usable; }
   bool has_free() const { return initialized && used < capacity; }
   bool is_full() const { return initialized && used == capacity; }
 
+  bool has_deferred_frees() const {
+    return thread_free.load(std::memory_order_seq_cst) != nullptr;
+  }
+
   bool contains_ptr(void *ptr) const {
     if (!initialized || !ptr)
       return false;
@@ -289,43 +826,115 @@ public:
     return p >= b && p < (b + page_span);
   }
 
+  // owner only: steal the whole remote list and fold it back into the
+  // bitmap / local_free. a chunk pushed twice is caught by the bitmap check
+  // in free_local before the list can loop.
+  void drain_deferred() {
+    page_status_t before = EMPTY;
+    page_status_t after = EMPTY;
+    void *list = thread_free.exchange(nullptr, std::memory_order_acquire);
+    if (list)
+      stat_add(COUNTER_drains);
+    uint32_t drained = 0;
+    while (list) {
+      INTEGRITY_CHECK(drained++ < capacity, "remote free list longer than its page");
+      void *next = chunk_next(list); // read before zero-on-free can wipe it
+      (void)free_local(list, nullptr, &before, &after);
+      list = next;
+    }
+  }
+
+  // owner only: forget every chunk at once by resetting the bitmap. the
+  // remote list is dropped after counting it, since those chunks were
+  // already freed; returns how many chunks were still live
+  uint32_t rewind() {
+    if (!initialized)
+      return 0;
+    uint32_t pending = 0;
+    for (void *c = thread_free.exchange(nullptr, std::memory_order_acquire); c;
+         c = chunk_next(c))
+      INTEGRITY_CHECK(pending++ < used, "remote free list longer than its live chunks");
+    const uint32_t live = used - pending;
+    (void)init(base, size_class, get_class_index());
+    return live;
+  }
+
+  bool is_decommitted() const { return decommitted; }
+
+  // owner only: stamp an EMPTY page the first time a purge pass sees it;
+  // true once it has stayed EMPTY for `delay_ns` (immediately when `force`)
+  bool idle_for_purge(uint64_t now, uint64_t delay_ns, bool force) {
+    if (!initialized || used != 0 || decommitted)
+      return false;
+    if (empty_since_ns == 0) {
+      empty_since_ns = now;
+      g_retained_empty_bytes.fetch_add(page_span, std::memory_order_relaxed);
+      return force;
+    }
+    return force || now - empty_since_ns >= delay_ns;
+  }
+
+  // owner only: the caller just dropped this page's memory. the bitmap is
+  // out of line, so only the chunk lists need forgetting.
+  void note_decommitted() {
+    if (empty_since_ns != 0)
+      g_retained_empty_bytes.fetch_sub(page_span, std::memory_order_relaxed);
+    empty_since_ns = 0;
+    decommitted = true;
+    zero_above = 0;
+    frees_scrubbed = true;
+    local_free = nullptr; // its links lived in the dropped memory
+    first_hint = 0;
+  }
+
   void *allocate(size_t req, page_status_t *before, page_status_t *after) {
-    if (!can_hold(req) || used == capacity)
+    if (!can_hold(req))
       return nullptr;
 
-    if (deferred_frees.approx_size() >= 32) {
-      drain_deferred_locked(16);
+    *before = status;
+
+    // a fresh page hands slots out in address order with no bitmap work;
+    // remote frees wait on thread_free until the cursor hits the end
+    if (bumping) {
+      const uint32_t slot = bump_top;
+      if (slot < capacity) {
+        void *out = take_slot(slot, false);
+        __atomic_store_n(&bump_top, slot + 1, __ATOMIC_RELAXED);
+        *after = status;
+        return out;
+      }
+      end_bump();
     }
 
-    *before = status;
+    if (!local_free && has_deferred_frees())
+      drain_deferred();
+
+    if (void *chunk = local_free) {
+      local_free = chunk_next(chunk);
+      set_chunk_next(chunk, nullptr);
+      uint32_t slot = 0;
+      if (!ptr_to_slot_idx(chunk, &slot))
+        std::abort();
+      void *out = take_slot(slot);
+      *after = status;
+      return out;
+    }
 
-    const uint32_t start = first_hint;
-    const uint32_t words = static_cast<uint32_t>(used_bitmap.size());
-    if (words == 0)
+    // local_free is empty here, so every clear bit really is a free slot
+    if (used == capacity) {
+      *after = status;
       return nullptr;
+    }
 
-    uint32_t word_idx = start >> 6; // div by 64 bitmap idx
-    const uint32_t start_word = word_idx;
-    for (;;) {
-      uint64_t word = used_bitmap[word_idx];
-      if (~word != 0ULL) {
-        uint32_t bit = static_cast<uint32_t>(__builtin_ctzll(~word));
-        uint32_t slot = (word_idx << 6) + bit;
-        if (slot < capacity) {
-          bit_set(slot);
-          used++;
-          first_hint = slot;
-          if (owner_tid == 0)
-            owner_tid = current_tid();
-          status = (used == capacity) ? FULL : ACTIVE;
-
-          *after = status;
-          return slot_ptr(slot);
-        }
-      }
-      word_idx = (word_idx + 1) % words;
-      if (word_idx == start_word)
-        break;
+    // the summary finds the word, ctz finds the bit
+    const uint32_t word_idx = next_free_word(first_hint >> 6);
+    if (word_idx != UINT32_MAX) {
+      const uint32_t slot =
+          (word_idx << 6) + static_cast<uint32_t>(__builtin_ctzll(~used_bitmap[word_idx]));
+      first_hint = slot;
+      void *out = take_slot(slot);
+      *after = status;
+      return out;
     }
 
     status = FULL;
@@ -333,6 +942,73 @@ public:
     return nullptr;
   }
 
+  // owner only: up to `n` chunks in one go. local_free first, then a single
+  // sweep over the bitmap taking every clear bit of a word via ctz
+  // `zeroed`, if given, gets whether each chunk is known to be all zero
+  size_t allocate_batch(size_t req, void **out, size_t n, page_status_t *before,
+                        page_status_t *after, bool *zeroed = nullptr) {
+    *before = status;
+    *after = status;
+    if (!can_hold(req) || n == 0)
+      return 0;
+
+    size_t got = 0;
+    if (bumping) {
+      uint32_t slot = bump_top;
+      while (got < n && slot < capacity) {
+        out[got] = take_slot(slot++, false);
+        if (zeroed)
+          zeroed[got] = g_last_alloc_dirty == 0;
+        got++;
+      }
+      __atomic_store_n(&bump_top, slot, __ATOMIC_RELAXED);
+      if (got == n) {
+        *after = status;
+        return got;
+      }
+      end_bump();
+    }
+
+    if (!local_free && has_deferred_frees())
+      drain_deferred();
+
+    while (got < n && local_free) {
+      void *chunk = local_free;
+      local_free = chunk_next(chunk);
+      set_chunk_next(chunk, nullptr);
+      uint32_t slot = 0;
+      if (!ptr_to_slot_idx(chunk, &slot))
+        std::abort();
+      out[got] = take_slot(slot);
+      if (zeroed)
+        zeroed[got] = g_last_alloc_dirty == 0;
+      got++;
+    }
+
+    // local_free is empty here, so every clear bit really is a free slot.
+    // the summary skips straight to words with free bits
+    uint32_t word_idx = first_hint >> 6;
+    while (got < n && used < capacity) {
+      word_idx = next_free_word(word_idx);
+      if (word_idx == UINT32_MAX)
+        break;
+      uint64_t free_bits = ~used_bitmap[word_idx];
+      while (free_bits != 0ULL && got < n) {
+        const uint32_t slot =
+            (word_idx << 6) + static_cast<uint32_t>(__builtin_ctzll(free_bits));
+        first_hint = slot;
+        out[got] = take_slot(slot);
+        if (zeroed)
+          zeroed[got] = g_last_alloc_dirty == 0;
+        got++;
+        free_bits &= free_bits - 1;
+      }
+    }
+
+    *after = status;
+    return got;
+  }
+
   bool free_local(void *ptr, size_t *usable_out, page_status_t *before,
                   page_status_t *after) {
     if (!contains_ptr(ptr))
@@ -342,17 +1018,22 @@ public:
       return false;
 
     *before = status;
+    if (bumping)
+      end_bump(); // the first free switches the page to the bitmap
     if (!bit_is_set(slot))
       std::abort();
 
-    if (g_zero_on_free.load(std::memory_order_relaxed)) {
-      std::memset(ptr, 0, chunk_usable);  
-    }
+    if constexpr (HeapPolicy::zero_on_free)
+      std::memset(ptr, 0, chunk_usable);
+    else
+      frees_scrubbed = false;
 
     bit_clear(slot);
     used--;
     if (slot < first_hint)
       first_hint = slot;
+    set_chunk_next(ptr, local_free);
+    local_free = ptr;
 
     status = (used == 0) ? EMPTY : ACTIVE;
     *after = status;
@@ -362,18 +1043,51 @@ public:
     return true;
   }
 
+  // owner only: vet a chunk headed for the magazine. it keeps its bitmap
+  // bit, so this is the last chance to catch a free of a free chunk
+  bool check_live_chunk(void *ptr) const {
+    uint32_t slot = 0;
+    if (!contains_ptr(ptr) || !ptr_to_slot_idx(ptr, &slot))
+      return false;
+    if (!slot_live(slot))
+      std::abort();
+    return true;
+  }
+
   bool enqueue_deferred_free(void *ptr, size_t *usable_out) {
     if (!contains_ptr(ptr))
       return false;
     uint32_t slot = 0;
     if (!ptr_to_slot_idx(ptr, &slot))
       return false;
-    if (!bit_is_set(slot))
+    if (!slot_live(slot))
       std::abort();
 
     if (usable_out)
       *usable_out = chunk_usable;
-    return deferred_frees.push(ptr);
+    push_thread_free(ptr, ptr);
+    return true;
+  }
+
+  // remote half of a bulk free: validate every chunk, link them through
+  // their first words and hand the whole chain over with a single CAS
+  bool enqueue_deferred_batch(void *const *ptrs, size_t n, size_t *usable_out) {
+    if (n == 0)
+      return true;
+    for (size_t i = 0; i < n; ++i) {
+      uint32_t slot = 0;
+      if (!contains_ptr(ptrs[i]) || !ptr_to_slot_idx(ptrs[i], &slot))
+        return false;
+      if (!slot_live(slot))
+        std::abort();
+    }
+    for (size_t i = 0; i + 1 < n; ++i)
+      set_chunk_next(ptrs[i], ptrs[i + 1]);
+    push_thread_free(ptrs[0], ptrs[n - 1]);
+
+    if (usable_out)
+      *usable_out = chunk_usable * n;
+    return true;
   }
 
   size_t usable_size(void *ptr) const {
@@ -383,8 +1097,8 @@ public:
     if (!ptr_to_slot_idx(ptr, &slot))
       return 0;
 
-    if (g_uaf_check.load(std::memory_order_relaxed)) {
-      if (!bit_is_set(slot))
+    if constexpr (HeapPolicy::uaf_check) {
+      if (!slot_live(slot))
         std::abort();
     }
 
@@ -392,55 +1106,100 @@ public:
   }
 
   page_kind_t get_size_class() const { return size_class; }
+  // may be stale on a page the caller doesn't own; a page queued under the
+  // wrong class is re-queued by whoever claims it
+  size_t get_class_index() const { return __atomic_load_n(&class_idx, __ATOMIC_RELAXED); }
   page_status_t get_status() const { return status; }
   size_t get_chunk_usable() const { return chunk_usable; }
-  pid_t get_owner_tid() const { return owner_tid; }
+  owner_id_t get_owner_tid() const { return owner_tid.load(std::memory_order_seq_cst); }
   size_t get_segment_index() const { return owner_segment_idx; }
   Segment *get_owner_segment() const { return owner_segment; }
 };
 
-class Segment {
+// hands a page back to the shared pool (defined after HeapState)
+static void release_page(Page *page);
+// frees magazine chunks on behalf of thread `tid` running on numa `node`
+// (defined after HeapState)
+static void flush_chunks(void **chunks, size_t n, owner_id_t tid, unsigned node);
+// gives up a page whose owner thread is exiting (defined after HeapState)
+static void abandon_page(Page *page);
+
+// reserved segments start PROT_NONE and are committed this much at a time,
+// as pages are first tuned. a granule holds two small pages (or 32 tiny
+// ones), the same groups that purging and huge pages use.
+static constexpr size_t SEGMENT_COMMIT_STEP = HUGE_PAGE_SIZE;
+static constexpr size_t SEGMENT_COMMIT_GRANULES = SEGMENT_SIZE / SEGMENT_COMMIT_STEP;
+static_assert(SEGMENT_COMMIT_GRANULES <= 64, "commit mask is one word per segment");
+
+// serializes granule commits so two pages sharing a granule don't both
+// commit it. only taken the first time a granule is used.
+static std::mutex g_commit_mu;
+
+// a segment header sits in the metadata arena directly in front of its
+// page descriptors. read-mostly fields share the first line; the counters
+// every thread updates get their own.
+class alignas(CACHE_LINE_SIZE) Segment {
 private:
   void *base;
+  size_t index;
   page_kind_t size_class;
   size_t page_size;
   size_t page_count;
-  std::unique_ptr<Page[]> pages;
-  std::atomic<size_t> next_candidate_idx;
-  std::atomic<uint32_t> full_pages;
-  std::atomic<bool> queued_non_full;
-  std::atomic<bool> fixed_chunk_set;
-  std::atomic<size_t> fixed_chunk_usable;
+  Page *pages;                        // page_count descriptors right after the header
+  unsigned numa_node;                 // node the segment's memory is bound to
   uint64_t key;
   uint64_t canary;
+  std::atomic<uint64_t> committed;    // bit g: granule g is read/write
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> next_candidate_idx;
+  std::atomic<uint32_t> active_pages; // pages holding at least one live chunk
+  std::atomic<bool> queued_non_full;
+  std::atomic<Segment *> queue_next;  // shard queue link
+
+  void note_transition(page_status_t before, page_status_t after) {
+    if (before == EMPTY && after != EMPTY)
+      active_pages.fetch_add(1, std::memory_order_relaxed);
+    else if (before != EMPTY && after == EMPTY)
+      active_pages.fetch_sub(1, std::memory_order_relaxed);
+  }
 
 public:
   Segment()
-      : base(nullptr), size_class(PAGE_SM), page_size(0), page_count(0), pages(),
-        next_candidate_idx(0), full_pages(0), queued_non_full(false),
-        fixed_chunk_set(false), fixed_chunk_usable(0), key(0), canary(0) {}
+      : base(nullptr), index(0), size_class(PAGE_SM), page_size(0), page_count(0),
+        pages(nullptr), numa_node(0), key(0), canary(0), committed(0), next_candidate_idx(0),
+        active_pages(0),
+        queued_non_full(false), queue_next(nullptr) {}
+
+  // bytes of arena a segment of `kind` takes: header plus page descriptors
+  static constexpr size_t metadata_bytes(page_kind_t kind) {
+    return sizeof(Segment) + (SEGMENT_SIZE / page_kind_size(kind)) * sizeof(Page);
+  }
 
-  bool init(void *segment_base, page_kind_t kind, size_t seg_idx) {
-    if (!segment_base)
+  // `pages_mem` is the arena space right after this header. `is_committed`
+  // says the memory is already read/write (overflow maps); otherwise it is
+  // reserved and each page commits on first use.
+  bool init(void *segment_base, page_kind_t kind, size_t seg_idx, unsigned node,
+            void *pages_mem, bool is_committed) {
+    if (!segment_base || !pages_mem)
       return false;
 
     base = segment_base;
+    index = seg_idx;
+    numa_node = node;
     size_class = kind;
     page_size = page_size_for_kind(kind);
     page_count = SEGMENT_SIZE / page_size;
     if (page_count == 0)
       return false;
 
-    pages.reset(new Page[page_count]);
-    for (size_t i = 0; i < page_count; ++i) {
-      pages[i].set_owner_segment(this, seg_idx);
-    }
+    // arena memory is fresh zeroes, which is what Page() builds, so the
+    // descriptors are left alone (and unfaulted) until their page is first
+    // used. a segment of 2048 tiny pages would otherwise touch 1.4MiB here.
+    pages = static_cast<Page *>(pages_mem);
 
+    committed.store(is_committed ? ~ZU(0) : 0, std::memory_order_relaxed);
     next_candidate_idx.store(0, std::memory_order_relaxed);
-    full_pages.store(0, std::memory_order_relaxed);
+    active_pages.store(0, std::memory_order_relaxed);
     queued_non_full.store(false, std::memory_order_relaxed);
-    fixed_chunk_set.store(false, std::memory_order_relaxed);
-    fixed_chunk_usable.store(0, std::memory_order_relaxed);
 
     key = generate_canary();
     canary = key;
@@ -448,6 +1207,9 @@ public:
   }
 
   page_kind_t get_size_class() const { return size_class; }
+  size_t get_index() const { return index; }
+  unsigned get_numa_node() const { return numa_node; }
+  void *get_base() const { return base; }
   bool check_canary(uint64_t expected) const { return canary == expected; }
   uint64_t get_key() const { return key; }
   size_t num_pages() const { return page_count; }
@@ -471,14 +1233,9 @@ public:
     return true;
   }
 
+  // true while some page is untouched or EMPTY and can be tuned to any class
   bool has_free_pages() const {
-    return full_pages.load(std::memory_order_relaxed) < page_count;
-  }
-
-  bool can_hold_request(size_t req) const {
-    if (!fixed_chunk_set.load(std::memory_order_relaxed))
-      return true;
-    return req <= fixed_chunk_usable.load(std::memory_order_relaxed);
+    return active_pages.load(std::memory_order_relaxed) < page_count;
   }
 
   bool try_mark_enqueued() {
@@ -489,56 +1246,89 @@ public:
 
   void clear_enqueued() { queued_non_full.store(false, std::memory_order_release); }
 
-  void *allocate(size_t req, Page **page_out) {
-    if (!page_out)
+  Segment *get_queue_next() const { return queue_next.load(std::memory_order_relaxed); }
+  void set_queue_next(Segment *next) { queue_next.store(next, std::memory_order_relaxed); }
+
+  // caller owns `page`; allocate from it without any locking
+  void *allocate_on_page(Page *page, size_t req, page_status_t *after) {
+    if (!page || !after)
       return nullptr;
-    if (!can_hold_request(req))
+    page_status_t before = EMPTY;
+    void *ptr = page->allocate(req, &before, after);
+    if (ptr)
+      note_transition(before, *after);
+    return ptr;
+  }
+
+  // caller owns `page`
+  size_t allocate_batch_on_page(Page *page, size_t req, void **out, size_t n,
+                                bool *zeroed = nullptr) {
+    page_status_t before = EMPTY;
+    page_status_t after = EMPTY;
+    const size_t got = page->allocate_batch(req, out, n, &before, &after, zeroed);
+    if (got)
+      note_transition(before, after);
+    return got;
+  }
+
+  // caller owns page `idx`: make its memory read/write before it is first
+  // touched. once committed a granule stays so; purging only drops its
+  // physical pages.
+  bool commit_page(size_t idx) {
+    const size_t first = idx * page_size / SEGMENT_COMMIT_STEP;
+    const size_t count = page_size > SEGMENT_COMMIT_STEP ? page_size / SEGMENT_COMMIT_STEP : 1;
+    const uint64_t want = ((ZU(1) << count) - 1) << first;
+    if ((committed.load(std::memory_order_acquire) & want) == want)
+      return true;
+
+    std::lock_guard<std::mutex> lk(g_commit_mu);
+    const uint64_t have = committed.load(std::memory_order_relaxed);
+    if ((have & want) == want)
+      return true;
+    // a page's granules are committed all at once, so none of `want` is set
+    if (!commit_region(static_cast<char *>(base) + first * SEGMENT_COMMIT_STEP,
+                       count * SEGMENT_COMMIT_STEP))
+      return false;
+    committed.store(have | want, std::memory_order_release);
+    return true;
+  }
+
+  // claim an unowned page in this segment for `cls`: one already tuned to it,
+  // or an untouched/EMPTY page that gets (re)tuned to the class geometry
+  void *allocate(size_t cls, size_t req, owner_id_t tid, Page **page_out, page_status_t *after) {
+    if (!page_out || !after)
       return nullptr;
-    const bool mt = g_live_threads.load(std::memory_order_relaxed) > 1;
 
     const size_t start = next_candidate_idx.load(std::memory_order_relaxed) % page_count;
     for (size_t step = 0; step < page_count; ++step) {
       const size_t idx = (start + step) % page_count;
       Page &page = pages[idx];
-      void *out = nullptr;
-      page_status_t before = EMPTY;
-      page_status_t after = EMPTY;
-      auto alloc_from_page = [&]() -> void * {
-        const size_t target_req =
-            (fixed_chunk_set.load(std::memory_order_relaxed))
-                ? fixed_chunk_usable.load(std::memory_order_relaxed)
-                : req;
-        if (!page.is_initialized()) {
-          void *page_base = static_cast<void *>(static_cast<char *>(base) + idx * page_size);
-          if (!page.init(page_base, size_class, target_req))
-            return nullptr;
-          if (!fixed_chunk_set.load(std::memory_order_relaxed)) {
-            fixed_chunk_usable.store(page.get_chunk_usable(), std::memory_order_relaxed);
-            fixed_chunk_set.store(true, std::memory_order_relaxed);
-          }
-        }
-        if (!page.can_hold(req)) {
-          return nullptr;
-        }
-
-        return page.allocate(req, &before, &after);
-      };
+      if (page.get_owner_tid() != 0 || !page.try_claim(tid))
+        continue;
 
-      if (mt) {
-        std::lock_guard<std::mutex> lk(page_lock_for(&page));
-        out = alloc_from_page();
+      if (!page.is_initialized()) {
+        void *page_base = static_cast<void *>(static_cast<char *>(base) + idx * page_size);
+        page.set_owner_segment(this, index);
+        if (!commit_page(idx) || !page.init(page_base, size_class, cls)) {
+          page.release();
+          continue;
+        }
       } else {
-        out = alloc_from_page();
+        (void)drain_page(&page);
+        if (page.get_class_index() != cls &&
+            (page.get_status() != EMPTY || !page.retune_if_empty(cls))) {
+          release_page(&page);
+          continue;
+        }
       }
 
-      if (!out)
+      void *out = allocate_on_page(&page, req, after);
+      if (!out) {
+        release_page(&page);
         continue;
-
-      if (before != FULL && after == FULL) {
-        full_pages.fetch_add(1, std::memory_order_relaxed);
       }
 
-      next_candidate_idx.store((after == FULL) ? ((idx + 1) % page_count) : idx,
+      next_candidate_idx.store((*after == FULL) ? ((idx + 1) % page_count) : idx,
                                std::memory_order_relaxed);
       *page_out = &page;
       return out;
@@ -547,50 +1337,170 @@ public:
     return nullptr;
   }
 
-  bool free_on_page(Page *page, void *ptr, size_t *usable_out, page_status_t *before,
-                    page_status_t *after) {
-    if (!page)
+  // pages decommitted together. in huge page mode tiny/small pages go in
+  // whole-THP groups so purging never splits one; medium/large pages are
+  // whole huge pages.
+  size_t purge_group_pages() const {
+    if (!huge_pages_enabled() || page_size >= HUGE_PAGE_SIZE)
+      return 1;
+    return HUGE_PAGE_SIZE / page_size;
+  }
+
+  // one step of a purge pass over pages [first, first + purge_group_pages()):
+  // claim whichever nobody owns, fold in their remote frees, and drop the
+  // group's memory in one madvise once every page in it is idle EMPTY (or
+  // untouched/already purged). returns true if some page became EMPTY here.
+  bool purge_group(size_t first, owner_id_t tid, uint64_t now, uint64_t delay_ns, bool force) {
+    static constexpr size_t MAX_GROUP = HUGE_PAGE_SIZE / TINY_PAGE_SIZE;
+    if (first >= page_count)
       return false;
+    // no page in a granule that was never committed has been used, and
+    // claiming them would only fault their descriptors in
+    if ((committed.load(std::memory_order_acquire) &
+         (ZU(1) << (first * page_size / SEGMENT_COMMIT_STEP))) == 0)
+      return false;
+    size_t count = purge_group_pages();
+    if (count > MAX_GROUP)
+      count = MAX_GROUP;
+    if (count > page_count - first)
+      count = page_count - first;
+
+    std::array<Page *, MAX_GROUP> claimed{};
+    size_t n_claimed = 0;
+    bool ready = true;
+    bool dirty = false;
+    bool emptied = false;
+    for (size_t i = 0; i < count; ++i) {
+      Page &page = pages[first + i];
+      if (page.get_owner_tid() != 0 || !page.try_claim(tid)) {
+        ready = false;
+        continue;
+      }
+      claimed[n_claimed++] = &page;
+      if (!page.is_initialized())
+        continue;
 
-    const bool mt = g_live_threads.load(std::memory_order_relaxed) > 1;
-    bool ok = false;
-    if (mt) {
-      std::lock_guard<std::mutex> lk(page_lock_for(page));
-      ok = page->free_local(ptr, usable_out, before, after);
-    } else {
-      ok = page->free_local(ptr, usable_out, before, after);
+      const page_status_t prev = page.get_status();
+      page.drain_deferred();
+      const page_status_t now_status = page.get_status();
+      note_transition(prev, now_status);
+      emptied |= prev != EMPTY && now_status == EMPTY;
+      if (page.is_decommitted() && now_status == EMPTY)
+        continue;
+      dirty = true;
+      if (!page.idle_for_purge(now, delay_ns, force))
+        ready = false;
     }
-    if (!ok)
-      return false;
 
-    if (*before == FULL && *after != FULL) {
-      full_pages.fetch_sub(1, std::memory_order_relaxed);
+    if (ready && dirty) {
+      decommit_pages(static_cast<char *>(base) + first * page_size, count * page_size);
+      for (size_t i = 0; i < n_claimed; ++i) {
+        if (claimed[i]->is_initialized())
+          claimed[i]->note_decommitted();
+      }
     }
+
+    for (size_t i = 0; i < n_claimed; ++i) {
+      if (claimed[i]->is_initialized())
+        release_page(claimed[i]);
+      else
+        claimed[i]->release();
+    }
+    return emptied;
+  }
+
+  // caller owns `page`: fold its remote frees in; true if that emptied it
+  bool drain_page(Page *page) {
+    const page_status_t prev = page->get_status();
+    page->drain_deferred();
+    const page_status_t now_status = page->get_status();
+    note_transition(prev, now_status);
+    return prev != EMPTY && now_status == EMPTY;
+  }
+
+  // caller owns `page`: drop all its chunks; true if it held any before
+  bool rewind_page(Page *page, uint32_t *live_out) {
+    const page_status_t prev = page->get_status();
+    *live_out = page->rewind();
+    note_transition(prev, EMPTY);
+    return prev != EMPTY;
+  }
+
+  // caller owns `page`
+  bool free_on_page(Page *page, void *ptr, size_t *usable_out, page_status_t *before,
+                    page_status_t *after) {
+    if (!page)
+      return false;
+    if (!page->free_local(ptr, usable_out, before, after))
+      return false;
+    note_transition(*before, *after);
     return true;
   }
 };
 
+// chunks in a magazine are still marked used in their page's bitmap; to the
+// page they are live allocations until the magazine flushes them back
+struct Magazine {
+  uint32_t count;
+  uint32_t cap;
+  uintptr_t slots[TCACHE_SLOTS]; // chunk | TCACHE_ZERO_TAG, oldest first
+};
+
 class ThreadCache {
 private:
-  static std::atomic<uint32_t> live_threads;
-  pid_t tid;
+  owner_id_t tid;
   bool is_active;
-  Page *cached_pages[3];
-  size_t preferred_seg_idx[3];
-  bool preferred_seg_valid[3];
+  std::array<Page *, NUM_SIZE_CLASSES> owned_pages; // at most one owned page per class
+  size_t preferred_seg_idx[NUM_PAGE_KINDS];
+  bool preferred_seg_valid[NUM_PAGE_KINDS];
+  std::array<Magazine, TCACHE_CLASSES> mags;
+  size_t mag_bytes; // bytes sitting in all magazines
+  unsigned numa_node;
+  uint32_t numa_countdown;
+
+  // hand the `n` oldest entries of `cls` back to their pages
+  void flush_magazine(size_t cls, uint32_t n) {
+    Magazine &m = mags[cls];
+    if (n > m.count)
+      n = m.count;
+    if (n == 0)
+      return;
+    void *chunks[TCACHE_SLOTS];
+    for (uint32_t i = 0; i < n; ++i)
+      chunks[i] = reinterpret_cast<void *>(m.slots[i] & ~TCACHE_ZERO_TAG);
+    std::memmove(m.slots, m.slots + n, (m.count - n) * sizeof(m.slots[0]));
+    m.count -= n;
+    mag_bytes -= n * SIZE_CLASSES[cls].stride;
+    flush_chunks(chunks, n, tid, numa_node);
+  }
 
 public:
   ThreadCache()
-      : tid(current_tid()), is_active(true), cached_pages{nullptr, nullptr, nullptr},
-        preferred_seg_idx{0, 0, 0},
-        preferred_seg_valid{false, false, false} {
-    live_threads.fetch_add(1, std::memory_order_relaxed);
-    g_live_threads.fetch_add(1, std::memory_order_relaxed);
+      : tid(next_thread_id()), is_active(true), owned_pages(), preferred_seg_idx{},
+        preferred_seg_valid{}, mags(), mag_bytes(0), numa_node(0),
+        numa_countdown(NUMA_REFRESH_EVERY - 1) {
+    owned_pages.fill(nullptr);
+    if (g_numa_nodes.load(std::memory_order_relaxed) > 1)
+      numa_node = current_numa_node();
+    for (size_t cls = 0; cls < TCACHE_CLASSES; ++cls)
+      mags[cls].cap = tcache_cap_for(cls);
+    counters_attach();
   }
 
+  // thread exit: everything the thread held goes back to the shared pool
+  // so other threads adopt it. destructors of other thread_locals may still
+  // malloc/free after this; an inactive cache keeps nothing for itself.
   ~ThreadCache() {
-    live_threads.fetch_sub(1, std::memory_order_relaxed);
-    g_live_threads.fetch_sub(1, std::memory_order_relaxed);
+    is_active = false;
+    flush_magazines();
+    for (Page *&page : owned_pages) {
+      if (page)
+        abandon_page(page);
+      page = nullptr;
+    }
+    if (void (*hook)() = g_thread_exit_hook.load(std::memory_order_acquire))
+      hook();
+    counters_detach();
   }
 
   static ThreadCache *current() {
@@ -598,33 +1508,94 @@ public:
     return &instance;
   }
 
-  static bool is_multi_threaded() {
-    return live_threads.load(std::memory_order_relaxed) > 1;
+  owner_id_t get_tid() const { return tid; }
+  bool get_active() const { return is_active; }
+  unsigned get_numa_node() const { return numa_node; }
+
+  // slow paths only, so a migrated thread follows its cpu to the new node
+  unsigned refresh_numa_node() {
+    const unsigned nodes = g_numa_nodes.load(std::memory_order_relaxed);
+    if (nodes <= 1)
+      return 0;
+    if (numa_countdown-- == 0) {
+      numa_countdown = NUMA_REFRESH_EVERY - 1;
+      numa_node = current_numa_node();
+    }
+    return numa_node < nodes ? numa_node : nodes - 1;
   }
 
-  pid_t get_tid() const { return tid; }
-  bool get_active() const { return is_active; }
+  Page *get_owned_page(size_t cls) const { return owned_pages[cls]; }
 
-  Page *get_cached_page(page_kind_t kind) const {
-    if (kind > PAGE_LG)
+  void set_owned_page(size_t cls, Page *page) { owned_pages[cls] = page; }
+
+  // the owned page ran dry: give it back to the shared pool
+  void retire_owned_page(size_t cls) {
+    Page *page = owned_pages[cls];
+    owned_pages[cls] = nullptr;
+    release_page(page);
+  }
+
+  // the hot path: pop the newest chunk, no page state touched
+  void *magazine_pop(size_t cls) {
+    Magazine &m = mags[cls];
+    if (m.count == 0)
       return nullptr;
-    return cached_pages[class_index_for_kind(kind)];
+    const uintptr_t entry = m.slots[--m.count];
+    const size_t stride = SIZE_CLASSES[cls].stride;
+    mag_bytes -= stride;
+    g_last_alloc_usable = stride;
+    g_last_alloc_dirty = (entry & TCACHE_ZERO_TAG) ? 0 : stride;
+    return reinterpret_cast<void *>(entry & ~TCACHE_ZERO_TAG);
   }
 
-  void cache_page(page_kind_t kind, Page *page) {
-    if (kind > PAGE_LG)
-      return;
-    const size_t idx = class_index_for_kind(kind);
-    cached_pages[idx] = page;
+  // false if the thread's byte budget is spent; the caller frees normally
+  bool magazine_push(size_t cls, void *chunk, bool zeroed) {
+    const size_t stride = SIZE_CLASSES[cls].stride;
+    if (mag_bytes + stride > TCACHE_MAX_BYTES)
+      return false;
+    Magazine &m = mags[cls];
+    const uintptr_t entry = reinterpret_cast<uintptr_t>(chunk);
+    // cheap catch for the common back-to-back double free; older
+    // duplicates are caught by the bitmap once the magazine flushes
+    if (m.count != 0 && (m.slots[m.count - 1] & ~TCACHE_ZERO_TAG) == entry)
+      std::abort();
+    if (m.count == m.cap)
+      flush_magazine(cls, m.cap / 2);
+    m.slots[m.count++] = entry | (zeroed ? TCACHE_ZERO_TAG : 0);
+    mag_bytes += stride;
+    return true;
   }
 
-  void clear_cached_page(page_kind_t kind, Page *page) {
-    if (kind > PAGE_LG)
-      return;
-    const size_t idx = class_index_for_kind(kind);
-    if (cached_pages[idx] == page) {
-      cached_pages[idx] = nullptr;
+  // free slots to refill into, in batch-sized steps
+  uint32_t magazine_refill_count(size_t cls) const {
+    const Magazine &m = mags[cls];
+    const uint32_t want = m.cap / 2;
+    return (m.cap - m.count < want) ? m.cap - m.count : want;
+  }
+
+  // stash freshly taken chunks; the caller sized `n` with magazine_refill_count
+  void magazine_fill(size_t cls, void *const *chunks, const bool *zeroed, size_t n) {
+    Magazine &m = mags[cls];
+    for (size_t i = 0; i < n; ++i) {
+      m.slots[m.count++] =
+          reinterpret_cast<uintptr_t>(chunks[i]) | (zeroed[i] ? TCACHE_ZERO_TAG : 0);
     }
+    mag_bytes += n * SIZE_CLASSES[cls].stride;
+  }
+
+  void flush_magazines() {
+    for (size_t cls = 0; cls < TCACHE_CLASSES; ++cls)
+      flush_magazine(cls, mags[cls].count);
+  }
+
+  // heap metadata was torn down under us: forget pages without releasing them
+  void reset() {
+    owned_pages.fill(nullptr);
+    for (Magazine &m : mags)
+      m.count = 0;
+    mag_bytes = 0;
+    for (bool &valid : preferred_seg_valid)
+      valid = false;
   }
 
   bool get_preferred_segment(page_kind_t kind, size_t *idx_out) const {
@@ -647,12 +1618,262 @@ public:
 
 };
 
-std::atomic<uint32_t> ThreadCache::live_threads{0};
 
-struct ClassShard {
-  std::mutex 					mu;
-  std::vector<size_t> segments;
-  std::deque<size_t> 	non_full_segments;
+// heap ids count down from -1 so they never collide with a thread id
+static std::atomic<owner_id_t> g_next_heap_id{0};
+
+// the state behind zialloc_heap_t. a heap owns pages the way a thread does,
+// through owner_tid, but under its own negative id, so chunks freed by
+// anyone else take the remote path. it keeps every page it ever adopted
+// until reset or destroy returns them in one sweep. one thread at a time.
+class UserHeap {
+private:
+  owner_id_t id;
+  std::array<Page *, NUM_SIZE_CLASSES> current; // page allocating for each class
+  Page *retired;                                // ran-dry pages still owned
+  XLHeader *xl_blocks;
+  size_t preferred_seg_idx[NUM_PAGE_KINDS];
+  bool preferred_seg_valid[NUM_PAGE_KINDS];
+  UserHeap *next_free;                          // recycled-heap list, under heap_mu
+
+public:
+  explicit UserHeap(owner_id_t heap_id)
+      : id(heap_id), current(), retired(nullptr), xl_blocks(nullptr),
+        preferred_seg_idx{}, preferred_seg_valid{},
+        next_free(nullptr) {
+    current.fill(nullptr);
+  }
+
+  // the owner interface allocate_from_pages shares with ThreadCache
+  owner_id_t get_tid() const { return id; }
+  bool get_active() const { return true; }
+  unsigned refresh_numa_node() { return ThreadCache::current()->refresh_numa_node(); }
+  Page *get_owned_page(size_t cls) const { return current[cls]; }
+  void set_owned_page(size_t cls, Page *page) { current[cls] = page; }
+
+  // a heap never gives pages back early; dry ones wait for reset/destroy
+  void retire_owned_page(size_t cls) {
+    current[cls]->set_heap_next(retired);
+    retired = current[cls];
+    current[cls] = nullptr;
+  }
+
+  bool get_preferred_segment(page_kind_t kind, size_t *idx_out) const {
+    const size_t idx = class_index_for_kind(kind);
+    if (kind > PAGE_LG || !preferred_seg_valid[idx])
+      return false;
+    *idx_out = preferred_seg_idx[idx];
+    return true;
+  }
+
+  void set_preferred_segment(page_kind_t kind, size_t seg_idx) {
+    if (kind > PAGE_LG)
+      return;
+    const size_t idx = class_index_for_kind(kind);
+    preferred_seg_idx[idx] = seg_idx;
+    preferred_seg_valid[idx] = true;
+  }
+
+  // keep_current leaves the per-class pages owned (reset); the rest are
+  // handed to `fn` and forgotten
+  template <typename Fn> void for_each_page(bool keep_current, Fn &&fn) {
+    for (Page *&page : current) {
+      if (!page)
+        continue;
+      fn(page, keep_current);
+      if (!keep_current)
+        page = nullptr;
+    }
+    for (Page *page = retired; page;) {
+      Page *next = page->get_heap_next();
+      page->set_heap_next(nullptr);
+      fn(page, false);
+      page = next;
+    }
+    retired = nullptr;
+  }
+
+  void link_xl(XLHeader *hdr) {
+    hdr->heap = this;
+    hdr->heap_prev = nullptr;
+    hdr->heap_next = xl_blocks;
+    if (xl_blocks)
+      xl_blocks->heap_prev = hdr;
+    xl_blocks = hdr;
+  }
+
+  void unlink_xl(XLHeader *hdr) {
+    if (hdr->heap_prev)
+      hdr->heap_prev->heap_next = hdr->heap_next;
+    else
+      xl_blocks = hdr->heap_next;
+    if (hdr->heap_next)
+      hdr->heap_next->heap_prev = hdr->heap_prev;
+    hdr->heap = nullptr;
+  }
+
+  XLHeader *take_xl_blocks() {
+    XLHeader *list = xl_blocks;
+    xl_blocks = nullptr;
+    return list;
+  }
+
+  UserHeap *get_next_free() const { return next_free; }
+  void set_next_free(UserHeap *next) { next_free = next; }
+};
+
+} // namespace
+
+// the type zialloc_memory.hpp hands out
+class Heap final : public UserHeap {
+public:
+  using UserHeap::UserHeap;
+};
+
+static_assert(std::is_trivially_destructible<Heap>::value,
+              "heaps live in the metadata arena and are recycled, never destroyed");
+
+namespace {
+
+// lock-free LIFO (Treiber stack) threaded through the nodes' own queue
+// link, so queueing never allocates or blocks. nodes live in the metadata
+// arena and are never freed before teardown, so a popper may read the link
+// of a node another thread just took; the tag packed into the head, bumped
+// on every update, makes that pop's CAS fail instead of installing a stale
+// link (ABA). nodes are cache-line aligned user-space pointers: shifted
+// down 6 bits they fit in the top 42 bits, leaving 22 for the tag.
+template <typename T> class TaggedStack {
+private:
+  static constexpr unsigned PTR_SHIFT = 6;
+  static constexpr unsigned TAG_BITS = 64 - (MAP_ADDRESS_BITS - PTR_SHIFT);
+  static constexpr uint64_t TAG_MASK = (ZU(1) << TAG_BITS) - 1;
+  static_assert(alignof(T) >= (ZU(1) << PTR_SHIFT), "node low bits hold no address");
+
+  std::atomic<uint64_t> head{0};
+
+  static uint64_t pack(T *node, uint64_t prev) {
+    const uint64_t p = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(node));
+    return ((p >> PTR_SHIFT) << TAG_BITS) | ((prev + 1) & TAG_MASK);
+  }
+  static T *unpack(uint64_t v) {
+    return reinterpret_cast<T *>(static_cast<uintptr_t>((v >> TAG_BITS) << PTR_SHIFT));
+  }
+
+public:
+  void push(T *node) {
+    uint64_t old = head.load(std::memory_order_relaxed);
+    for (;;) {
+      node->set_queue_next(unpack(old));
+      if (head.compare_exchange_weak(old, pack(node, old), std::memory_order_release,
+                                     std::memory_order_relaxed))
+        return;
+      stat_add(COUNTER_queue_retries);
+    }
+  }
+
+  T *pop() {
+    uint64_t old = head.load(std::memory_order_acquire);
+    while (T *node = unpack(old)) {
+      if (head.compare_exchange_weak(old, pack(node->get_queue_next(), old),
+                                     std::memory_order_acquire, std::memory_order_acquire))
+        return node;
+      stat_add(COUNTER_queue_retries);
+    }
+    return nullptr;
+  }
+
+  void clear() { head.store(0, std::memory_order_relaxed); }
+};
+
+// segments of one page kind with untouched/EMPTY pages. padded: every slow
+// path of the kind CASes the head
+struct alignas(CACHE_LINE_SIZE) ClassShard {
+  TaggedStack<Segment> non_full_segments;
+};
+
+// pages of one size class that still have free slots, from any segment
+struct alignas(CACHE_LINE_SIZE) ClassPageQueue {
+  TaggedStack<Page> pages;
+};
+
+// one numa node's pools: its slice of the reserved region and the queues
+// for segments bound to it. the counters are charged to the node whose
+// memory was touched from off-node.
+struct NodeHeap {
+  size_t reserved_lo = 0;     // offsets into the reserved region
+  size_t reserved_hi = 0;
+  size_t reserved_cursor = 0; // guarded by heap_mu
+  std::array<ClassShard, NUM_PAGE_KINDS> shards;
+  std::array<ClassPageQueue, NUM_SIZE_CLASSES> pages;
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> segments{0};
+  std::atomic<uint64_t> remote_frees{0}; // frees from threads on other nodes
+  std::atomic<uint64_t> remote_pages{0}; // pages adopted by threads on other nodes
+
+  void clear() {
+    for (ClassShard &shard : shards)
+      shard.non_full_segments.clear();
+    for (ClassPageQueue &queue : pages)
+      queue.pages.clear();
+    segments.store(0, std::memory_order_relaxed);
+    remote_frees.store(0, std::memory_order_relaxed);
+    remote_pages.store(0, std::memory_order_relaxed);
+  }
+};
+
+// segment headers with their page descriptors, and the segment table, live
+// here instead of the libc heap, so zialloc can sit under malloc itself. one
+// reservation sized for META_MAX_SEGMENTS of the densest kind, bump
+// allocated in cache-line multiples and committed META_COMMIT_STEP at a time.
+// segments are never given back, so neither is arena space before teardown.
+static constexpr size_t META_MAX_SEGMENTS = 4096;
+static constexpr size_t META_COMMIT_STEP = HUGE_PAGE_SIZE;
+static constexpr size_t META_TABLE_BYTES =
+    (META_MAX_SEGMENTS * sizeof(Segment *) + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+static constexpr size_t META_ARENA_BYTES =
+    (META_TABLE_BYTES + META_MAX_SEGMENTS * Segment::metadata_bytes(PAGE_TINY) +
+     META_COMMIT_STEP - 1) & ~(META_COMMIT_STEP - 1);
+
+static_assert(std::is_trivially_destructible<Segment>::value &&
+                  std::is_trivially_destructible<Page>::value,
+              "arena metadata is dropped without running destructors");
+
+class MetaArena {
+private:
+  char *base;
+  size_t cursor;
+  size_t committed;
+
+public:
+  MetaArena() : base(nullptr), cursor(0), committed(0) {}
+
+  // caller holds heap_mu
+  void *alloc(size_t bytes) {
+    if (!base) {
+      base = static_cast<char *>(reserve_region(META_ARENA_BYTES));
+      if (!base)
+        return nullptr;
+    }
+    const size_t need = align_up(bytes, CACHE_LINE_SIZE);
+    if (need > META_ARENA_BYTES - cursor)
+      return nullptr;
+    if (cursor + need > committed) {
+      const size_t upto = align_up(cursor + need, META_COMMIT_STEP);
+      if (!commit_region(base + committed, upto - committed))
+        return nullptr;
+      committed = upto;
+    }
+    void *out = base + cursor;
+    cursor += need;
+    return out;
+  }
+
+  void release() {
+    if (base)
+      free_segment(base, META_ARENA_BYTES);
+    base = nullptr;
+    cursor = 0;
+    committed = 0;
+  }
 };
 
 
@@ -660,165 +1881,262 @@ class HeapState {
 private:
   void *base;
   size_t reserved_size;
-  uint32_t num_segments;
-  std::vector<std::unique_ptr<Segment>> layout;
-  std::vector<void *> seg_bases;
+  MetaArena meta;
+  Segment **layout;                 // META_MAX_SEGMENTS slots in the arena
+  std::atomic<size_t> num_segments; // slots below this are published
   uint64_t canary;
-  size_t reserved_cursor;
   std::mutex heap_mu;
-  std::array<ClassShard, 3> class_shards;
+  unsigned numa_nodes;
+  std::array<NodeHeap, NUMA_MAX_NODES> nodes;
+  XLSpanCache xl_cache;
+  std::mutex purge_mu;
+  std::atomic<uint64_t> next_purge_ns;
+  size_t purge_seg_cursor;  // guarded by purge_mu
+  size_t purge_page_cursor; // guarded by purge_mu
+  UserHeap *free_heaps;     // destroyed heaps kept for reuse, guarded by heap_mu
+
+  ClassShard &shard_for(unsigned node, page_kind_t kind) {
+    return nodes[node].shards[class_index_for_kind(kind)];
+  }
 
-  ClassShard &shard_for(page_kind_t kind) {
-    return class_shards[class_index_for_kind(kind)];
+  // `n` chunks of `seg` were freed through the remote path by `node`
+  void note_remote_free(const Segment *seg, unsigned node, uint64_t n) {
+    if (numa_nodes > 1 && seg->get_numa_node() != node)
+      nodes[seg->get_numa_node()].remote_frees.fetch_add(n, std::memory_order_relaxed);
   }
 
-  void enqueue_non_full_segment(page_kind_t kind, size_t seg_idx) {
-    if (seg_idx >= layout.size())
+  // lock-free readers see only slots published through num_segments
+  Segment *segment_at(size_t idx) const {
+    if (idx >= num_segments.load(std::memory_order_acquire))
+      return nullptr;
+    return layout[idx];
+  }
+
+  void enqueue_non_full_page(Page *page) {
+    if (!page || !page->try_mark_enqueued())
       return;
-    Segment *seg = layout[seg_idx].get();
+    nodes[page->get_owner_segment()->get_numa_node()].pages[page->get_class_index()].pages.push(
+        page);
+  }
+
+  void enqueue_non_full_segment(page_kind_t kind, size_t seg_idx) {
+    Segment *seg = segment_at(seg_idx);
     if (!seg || !seg->has_free_pages())
       return;
     if (!seg->try_mark_enqueued())
       return;
 
-    ClassShard &shard = shard_for(kind);
-    std::lock_guard<std::mutex> lk(shard.mu);
-    shard.non_full_segments.push_back(seg_idx);
+    shard_for(seg->get_numa_node(), kind).non_full_segments.push(seg);
   }
 
-  bool add_segment_nolock(void *segment_base, page_kind_t page_kind) {
+  bool add_segment_nolock(void *segment_base, page_kind_t page_kind, unsigned node,
+                          bool committed) {
     if (!segment_base)
       return false;
 
-    const size_t idx = layout.size();
-    auto seg = std::make_unique<Segment>();
-    if (!seg->init(segment_base, page_kind, idx))
+    if (!layout) {
+      layout = static_cast<Segment **>(meta.alloc(META_TABLE_BYTES));
+      if (!layout)
+        return false;
+    }
+    const size_t idx = num_segments.load(std::memory_order_relaxed);
+    if (idx >= META_MAX_SEGMENTS)
       return false;
+    void *mem = meta.alloc(Segment::metadata_bytes(page_kind));
+    if (!mem)
+      return false;
+    Segment *seg = new (mem) Segment();
+    if (!seg->init(segment_base, page_kind, idx, node,
+                   static_cast<char *>(mem) + sizeof(Segment), committed))
+      return false;
+    nodes[node].segments.fetch_add(1, std::memory_order_relaxed);
 
-    layout.push_back(std::move(seg));
-    seg_bases.push_back(segment_base);
-    num_segments = static_cast<uint32_t>(layout.size());
+    segment_map_set(segment_base, SEGMENT_SIZE, reinterpret_cast<uintptr_t>(seg));
+    layout[idx] = seg;
+    num_segments.store(idx + 1, std::memory_order_release);
 
-    ClassShard &shard = shard_for(page_kind);
-    {
-      std::lock_guard<std::mutex> lk(shard.mu);
-      shard.segments.push_back(idx);
-    }
     enqueue_non_full_segment(page_kind, idx);
 
-    if (!base || reinterpret_cast<uintptr_t>(segment_base) < reinterpret_cast<uintptr_t>(base))
+    // base is the reserved region once there is one; overflow maps never move it
+    if (reserved_size == 0 &&
+        (!base || reinterpret_cast<uintptr_t>(segment_base) < reinterpret_cast<uintptr_t>(base)))
       base = segment_base;
 
     return true;
   }
 
-  bool add_segment_from_reserved_nolock(page_kind_t page_kind) {
+  // carves from `node`'s slice only; a full slice means the caller looks
+  // at other nodes before mapping more
+  bool add_segment_from_reserved_nolock(page_kind_t page_kind, unsigned node) {
     if (!base || reserved_size == 0)
       return false;
-    if (reserved_cursor + SEGMENT_SIZE > reserved_size)
+    NodeHeap &nh = nodes[node];
+    if (nh.reserved_cursor + SEGMENT_SIZE > nh.reserved_hi)
       return false;
 
-    void *seg_base = static_cast<void *>(static_cast<char *>(base) + reserved_cursor);
-    if (!commit_region(seg_base, SEGMENT_SIZE))
+    void *seg_base = static_cast<void *>(static_cast<char *>(base) + nh.reserved_cursor);
+    // policy first: nothing in the segment has faulted in yet. the memory
+    // stays PROT_NONE; pages commit themselves as they are first tuned
+    if (numa_nodes > 1)
+      bind_to_node(seg_base, SEGMENT_SIZE, node);
+
+    nh.reserved_cursor += SEGMENT_SIZE;
+    if (!add_segment_nolock(seg_base, page_kind, node, false))
       return false;
+    stat_add(COUNTER_reserved_growth);
+    return true;
+  }
+
+  // true if the cursor wrapped around the heap during the pass
+  bool purge_pass_locked(owner_id_t tid, uint64_t now) {
+    const size_t segs = num_segments.load(std::memory_order_acquire);
+    if (segs == 0)
+      return true;
+    const uint64_t delay = g_purge_delay_ns.load(std::memory_order_relaxed);
+    const size_t budget = g_purge_retained_budget.load(std::memory_order_relaxed);
+
+    bool wrapped = false;
+    for (size_t n = 0; n < PURGE_PAGES_PER_PASS; ++n) {
+      if (purge_seg_cursor >= segs) {
+        purge_seg_cursor = 0;
+        purge_page_cursor = 0;
+        wrapped = true;
+      }
+      Segment *seg = layout[purge_seg_cursor];
+      if (!seg || purge_page_cursor >= seg->num_pages()) {
+        purge_seg_cursor++;
+        purge_page_cursor = 0;
+        continue;
+      }
+      const bool force =
+          delay == 0 || g_retained_empty_bytes.load(std::memory_order_relaxed) > budget;
+      const size_t first = purge_page_cursor;
+      purge_page_cursor += seg->purge_group_pages();
+      if (seg->purge_group(first, tid, now, delay, force))
+        enqueue_non_full_segment(seg->get_size_class(), purge_seg_cursor);
+    }
+    stat_add(COUNTER_purge_passes);
+    return wrapped;
+  }
+
+  // cheap enough for slow paths: a thread-local countdown, then a clock
+  // read, then a try_lock so only one thread purges at a time
+  void maybe_purge(owner_id_t tid) {
+    if (g_purge_countdown-- != 0)
+      return;
+    g_purge_countdown = PURGE_CHECK_EVERY - 1;
 
-    reserved_cursor += SEGMENT_SIZE;
-    return add_segment_nolock(seg_base, page_kind);
+    if (g_background_active.load(std::memory_order_relaxed))
+      return;
+    const uint64_t now = monotonic_ns();
+    if (now < next_purge_ns.load(std::memory_order_relaxed))
+      return;
+    std::unique_lock<std::mutex> lk(purge_mu, std::try_to_lock);
+    if (!lk.owns_lock())
+      return;
+    next_purge_ns.store(now + PURGE_INTERVAL_NS, std::memory_order_relaxed);
+    (void)purge_pass_locked(tid, now);
   }
 
-  void *alloc_xl(size_t size) {
+  // mappings start SEGMENT_ALIGN aligned; a stricter `alignment` pads the
+  // mapping and slides the header up so the block after it lands aligned
+  void *alloc_xl(size_t size, size_t alignment = 16) {
     if (size >= (SIZE_MAX - 4096))
       return nullptr;
-    if (size > HEAP_RESERVED_DEFAULT)
+    if (size > HEAP_RESERVED_DEFAULT || alignment > HEAP_RESERVED_DEFAULT)
       return nullptr;
 
-    const size_t usable = align_up(size, 16);
-    const size_t map_size = align_up(usable + sizeof(XLHeader), 4096);
-    void *raw = alloc_segment(map_size);
+    const size_t pad = (alignment > 16) ? alignment : 0;
+    size_t map_size = xl_map_size_for(size) + pad;
+    bool zeroed = false;
+    void *raw = xl_cache.take(map_size, &map_size, &zeroed);
+    if (raw) {
+      stat_add(COUNTER_xl_cache_hits);
+    } else {
+      raw = alloc_segment(map_size);
+      zeroed = true;
+    }
     if (!raw)
       return nullptr;
 
-    auto *hdr = static_cast<XLHeader *>(raw);
+    const uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+    const uintptr_t user = align_up(start + sizeof(XLHeader), alignment);
+    auto *hdr = reinterpret_cast<XLHeader *>(user - sizeof(XLHeader));
     hdr->magic = XL_MAGIC;
     hdr->mapping_size = map_size;
-    hdr->usable_size = map_size - sizeof(XLHeader);
-    hdr->reserved = 0;
+    hdr->usable_size = start + map_size - user;
+    hdr->offset = reinterpret_cast<uintptr_t>(hdr) - start;
+    hdr->heap = nullptr;
+    hdr->heap_prev = hdr->heap_next = nullptr;
+    hdr->heap_released = 0;
+    segment_map_set(raw, map_size, reinterpret_cast<uintptr_t>(hdr) | MAP_TAG_XL);
     g_last_alloc_usable = hdr->usable_size;
+    g_last_alloc_dirty = zeroed ? 0 : hdr->usable_size;
+    stat_add(COUNTER_xl_allocs);
 
-    return static_cast<void *>(reinterpret_cast<char *>(raw) + sizeof(XLHeader));
+    return reinterpret_cast<void *>(user);
   }
 
-  bool free_xl(void *ptr, size_t *usable_out) {
+  bool free_xl(void *ptr, size_t *usable_out, size_t size_hint = 0) {
     if (!ptr)
       return false;
-    auto *hdr = reinterpret_cast<XLHeader *>(static_cast<char *>(ptr) - sizeof(XLHeader));
-    if (hdr->magic != XL_MAGIC)
+    XLHeader *hdr = xl_header_for(ptr);
+    if (!hdr || hdr->magic != XL_MAGIC)
       return false;
+    if (size_hint > hdr->usable_size)
+      std::abort();
 
-    if (g_zero_on_free.load(std::memory_order_relaxed)) {
+    if constexpr (HeapPolicy::zero_on_free)
       std::memset(ptr, 0, hdr->usable_size);
-    }
     if (usable_out)
       *usable_out = hdr->usable_size;
 
-    free_segment(hdr, hdr->mapping_size);
+    // a heap's block may be freed by any thread, but only the heap's user
+    // may unlink it, so it stays mapped until the heap lets go
+    if (hdr->heap) {
+      if (__atomic_exchange_n(&hdr->heap_released, 1, __ATOMIC_ACQ_REL) != 0)
+        std::abort();
+      return true;
+    }
+    release_xl_mapping(hdr);
     return true;
   }
 
+  void release_xl_mapping(XLHeader *hdr) {
+    const size_t mapping_size = hdr->mapping_size;
+    void *mapping = reinterpret_cast<char *>(hdr) - hdr->offset;
+    segment_map_set(mapping, mapping_size, 0);
+    hdr->magic = 0;
+    if (!xl_cache.put(mapping, mapping_size))
+      free_segment(mapping, mapping_size);
+  }
+
   size_t usable_xl(void *ptr) {
     if (!ptr)
       return 0;
-    auto *hdr = reinterpret_cast<XLHeader *>(static_cast<char *>(ptr) - sizeof(XLHeader));
-    if (hdr->magic != XL_MAGIC)
+    XLHeader *hdr = xl_header_for(ptr);
+    if (!hdr || hdr->magic != XL_MAGIC)
       return 0;
     return hdr->usable_size;
   }
 
+  // one load from the segment map, whether the segment came from the
+  // reserved region or an overflow mapping
   bool resolve_segment_for_ptr(void *ptr, size_t *seg_idx_out, Segment **seg_out) {
     if (!ptr || !seg_idx_out || !seg_out)
       return false;
 
-    const uintptr_t p = reinterpret_cast<uintptr_t>(ptr);
-    if (base && reserved_cursor > 0) {
-      const uintptr_t b = reinterpret_cast<uintptr_t>(base);
-      const uintptr_t end = b + reserved_cursor;
-      if (p >= b && p < end) {
-        const size_t idx = static_cast<size_t>((p - b) / SEGMENT_SIZE);
-        if (idx < layout.size()) {
-          Segment *seg = layout[idx].get();
-          if (seg && seg->contains(ptr)) {
-            *seg_idx_out = idx;
-            *seg_out = seg;
-            return true;
-          }
-        }
-      }
-    }
-    // TODO: still not sure if '~' is correct since i already subtract 1 from segment shift in type.h
-    const uintptr_t seg_base = p & ~static_cast<uintptr_t>(SEGMENT_MASK); 
-    for (size_t i = 0; i < seg_bases.size(); ++i) {
-      if (reinterpret_cast<uintptr_t>(seg_bases[i]) != seg_base)
-        continue;
-      if (i >= layout.size())
-        continue;
-      Segment *seg = layout[i].get();
-      if (seg && seg->contains(ptr)) {
-        *seg_idx_out = i;
-        *seg_out = seg;
-        return true;
-      }
-    }
-    // TODO: confirm neither this nor the above are necessary
-    for (size_t i = 0; i < layout.size(); ++i) {
-      Segment *seg = layout[i].get();
-      if (seg && seg->contains(ptr)) {
-        *seg_idx_out = i;
-        *seg_out = seg;
-        return true;
-      }
+    const uintptr_t entry = segment_map_get(ptr);
+    if (entry == 0 || (entry & MAP_TAG_XL) != 0)
+      return false;
+    Segment *seg = reinterpret_cast<Segment *>(entry);
+    if constexpr (HeapPolicy::canary_check) {
+      if (!seg->check_canary(seg->get_key()))
+        std::abort();
     }
-
-    return false;
+    *seg_idx_out = seg->get_index();
+    *seg_out = seg;
+    return true;
   }
 
   bool resolve_page_for_ptr(void *ptr, size_t *seg_idx_out, Segment **seg_out,
@@ -840,9 +2158,10 @@ private:
 
 public:
   HeapState()
-      : base(nullptr), reserved_size(0), num_segments(0), layout(),
-        seg_bases(), canary(0),
-        reserved_cursor(0), heap_mu(), class_shards() {}
+      : base(nullptr), reserved_size(0), meta(), layout(nullptr), num_segments(0), canary(0),
+        heap_mu(), numa_nodes(1), nodes(), xl_cache(),
+        purge_mu(), next_purge_ns(0), purge_seg_cursor(0), purge_page_cursor(0),
+        free_heaps(nullptr) {}
 
   static HeapState &instance() {
     static HeapState heap;
@@ -856,218 +2175,602 @@ public:
     std::lock_guard<std::mutex> lk(heap_mu);
     base = reserved_base;
     reserved_size = size;
-    reserved_cursor = 0;
     canary = generate_canary();
 
-    const size_t cap = size / SEGMENT_SIZE;
-    layout.reserve(cap);
-    seg_bases.reserve(cap);
-
-    for (ClassShard &shard : class_shards) {
-      std::lock_guard<std::mutex> shard_lk(shard.mu);
-      shard.segments.clear();
-      shard.non_full_segments.clear();
+    // the reservation is split into one whole-segment slice per node
+    numa_nodes = numa_node_count();
+    const size_t slice = (size / numa_nodes) & ~SEGMENT_MASK;
+    if (slice == 0)
+      numa_nodes = 1;
+    g_numa_nodes.store(numa_nodes, std::memory_order_relaxed);
+    for (unsigned n = 0; n < NUMA_MAX_NODES; ++n) {
+      NodeHeap &nh = nodes[n];
+      nh.clear();
+      nh.reserved_lo = n < numa_nodes ? n * slice : 0;
+      nh.reserved_hi = n + 1 < numa_nodes ? nh.reserved_lo + slice : (n < numa_nodes ? size : 0);
+      nh.reserved_cursor = nh.reserved_lo;
     }
 
     return true;
   }
 
-  bool add_segment_from_reserved(page_kind_t page_kind) {
-    std::lock_guard<std::mutex> lk(heap_mu);
-    return add_segment_from_reserved_nolock(page_kind);
+  // owner gives up `page`; keep it visible if it still has (or is about to
+  // get back) free slots
+  // owner is exiting: collect its remote frees now, so an emptied page can
+  // be retuned to any class, then hand it over. queued pages are adopted by
+  // whichever thread next misses its own page for the class.
+  void abandon_page(Page *page) {
+    Segment *seg = page->get_owner_segment();
+    if (seg->drain_page(page))
+      enqueue_non_full_segment(seg->get_size_class(), seg->get_index());
+    release_page(page);
+  }
+
+  void release_page(Page *page) {
+    if (!page)
+      return;
+    const bool has_free = page->has_free();
+    page->release();
+    // pairs with the owner check in free_ptr: either the remote freer sees
+    // owner == 0 and enqueues, or we see its pending free here
+    if (has_free || page->has_deferred_frees())
+      enqueue_non_full_page(page);
+  }
+
+  // grow or shrink an XL block by resizing its mapping, never by copying.
+  // nullptr when `ptr` isn't XL, `size` belongs in a size class, or the
+  // kernel refused; the caller falls back to allocate + copy.
+  void *resize_xl(void *ptr, size_t size, size_t *new_usable_out) {
+    XLHeader *hdr = xl_header_for(ptr);
+    if (!hdr || hdr->magic != XL_MAGIC || hdr->offset != 0 || hdr->heap)
+      return nullptr; // aligned and heap blocks are reallocated by copying
+    if (class_for_size(size) != PAGE_XL || size > HEAP_RESERVED_DEFAULT)
+      return nullptr;
+
+    const size_t old_map = hdr->mapping_size;
+    const size_t new_map = xl_map_size_for(size);
+    if (new_map != old_map) {
+      void *moved = remap_segment(hdr, old_map, new_map);
+      if (!moved)
+        return nullptr;
+      if (moved != static_cast<void *>(hdr)) {
+        segment_map_set(hdr, old_map, 0);
+      } else if (new_map < old_map) {
+        // drop granules that are now entirely past the end of the mapping
+        const uintptr_t keep_end =
+            align_up(reinterpret_cast<uintptr_t>(hdr) + new_map, SEGMENT_SIZE);
+        const uintptr_t old_end = reinterpret_cast<uintptr_t>(hdr) + old_map;
+        if (old_end > keep_end)
+          segment_map_set(reinterpret_cast<void *>(keep_end), old_end - keep_end, 0);
+      }
+      hdr = static_cast<XLHeader *>(moved);
+      hdr->mapping_size = new_map;
+      hdr->usable_size = new_map - sizeof(XLHeader);
+      segment_map_set(hdr, new_map, reinterpret_cast<uintptr_t>(hdr) | MAP_TAG_XL);
+    }
+    if (new_usable_out)
+      *new_usable_out = hdr->usable_size;
+    return static_cast<void *>(reinterpret_cast<char *>(hdr) + sizeof(XLHeader));
   }
 
   void *allocate(size_t size) {
     g_last_alloc_usable = 0;
+    g_last_alloc_dirty = SIZE_MAX;
+    if (class_for_size(size) == PAGE_XL)
+      return alloc_xl(size);
+
+    const size_t need = align_up(size, 16);
+    return allocate_in_class(size_class_for(need), need);
+  }
+
+  // page bases are aligned to the (power-of-two) page size, so a class whose
+  // stride is a multiple of `alignment` hands out aligned slots for free.
+  // every power of two from 16B to 16MiB is a class, so one always exists
+  // for alignments up to MAX_ALIGNMENT; anything else is an aligned XL map.
+  void *allocate_aligned(size_t size, size_t alignment) {
+    if (alignment <= 16)
+      return allocate(size);
+    g_last_alloc_usable = 0;
+    g_last_alloc_dirty = SIZE_MAX;
+    if (class_for_size(size) != PAGE_XL && alignment <= MAX_ALIGNMENT) {
+      const size_t need = align_up(size, 16);
+      for (size_t cls = size_class_for(need); cls < NUM_SIZE_CLASSES; ++cls) {
+        if ((SIZE_CLASSES[cls].stride & (alignment - 1)) == 0)
+          return allocate_in_class(cls, need);
+      }
+    }
+    return alloc_xl(size, alignment);
+  }
+
+  void *allocate_in_class(size_t cls, size_t need) {
     ThreadCache *tc = ThreadCache::current();
-    const bool mt = ThreadCache::is_multi_threaded();
+    if (cls < TCACHE_CLASSES) {
+      if (void *ptr = tc->magazine_pop(cls)) {
+        stat_add(COUNTER_magazine_hits);
+        return ptr;
+      }
+      if (void *ptr = refill_magazine(tc, cls, need)) {
+        stat_add(COUNTER_magazine_refills);
+        return ptr;
+      }
+    }
+    return allocate_from_pages(tc, cls, need);
+  }
 
-    page_kind_t kind = class_for_size(size);
-    if (kind == PAGE_XL) {
-      if (size <= LARGE_PAGE_SIZE) {
-        kind = PAGE_LG;
-      } else {
-        return alloc_xl(size);
+  // empty magazine: take a batch off the owned page in one bitmap sweep,
+  // return one chunk and stash the rest. nullptr when there's no owned page
+  // or it is full; the page path then finds a new one for the next refill.
+  void *refill_magazine(ThreadCache *tc, size_t cls, size_t need) {
+    Page *owned = tc->get_owned_page(cls);
+    if (!owned)
+      return nullptr;
+    void *chunks[TCACHE_SLOTS];
+    bool zeroed[TCACHE_SLOTS];
+    const size_t got = owned->get_owner_segment()->allocate_batch_on_page(
+        owned, need, chunks, tc->magazine_refill_count(cls) + 1, zeroed);
+    if (got == 0)
+      return nullptr;
+    tc->magazine_fill(cls, chunks + 1, zeroed + 1, got - 1);
+    g_last_alloc_usable = SIZE_CLASSES[cls].stride;
+    g_last_alloc_dirty = zeroed[0] ? 0 : SIZE_CLASSES[cls].stride;
+    return chunks[0];
+  }
+
+  // `Owner` is a ThreadCache or a UserHeap: whatever holds the pages, under the
+  // owner_tid its get_tid() returns
+  template <typename Owner> void *allocate_from_pages(Owner *tc, size_t cls, size_t need) {
+    const page_kind_t kind = SIZE_CLASSES[cls].kind;
+    const owner_id_t tid = tc->get_tid();
+
+    // an exited thread's cache keeps no page; it gives each one straight back
+    auto adopt = [&](Page *page) {
+      g_last_alloc_usable = page->get_chunk_usable();
+      if (tc->get_active())
+        tc->set_owned_page(cls, page);
+      else
+        release_page(page);
+    };
+
+    // ideal path - the page this thread owns for the class, no locks
+    if (Page *owned = tc->get_owned_page(cls)) {
+      page_status_t after = EMPTY;
+      void *fast = owned->get_owner_segment()->allocate_on_page(owned, need, &after);
+      if (fast) {
+        g_last_alloc_usable = owned->get_chunk_usable();
+        stat_add(COUNTER_owned_page_hits);
+        return fast;
       }
+      // full even after collecting remote frees: hand it back
+      tc->retire_owned_page(cls);
     }
 
-    const size_t need = align_up(size, 16);
+    const unsigned node = tc->refresh_numa_node();
+
+    // unowned pages already tuned to this class with free slots
+    auto probe_pages = [&](unsigned n) -> void * {
+      ClassPageQueue &queue = nodes[n].pages[cls];
+      size_t probes = 0;
+      while (probes < MAX_QUEUE_PROBES_PER_ALLOC) {
+        Page *page = queue.pages.pop();
+        if (!page)
+          break;
+        probes++;
+        stat_add(COUNTER_page_queue_probes);
+        page->clear_enqueued();
+        if (!page->try_claim(tid))
+          continue; // owned again; its owner re-queues it on release
 
-    // ideal path - try thread-local cached page first
-    if (tc->get_active()) {
-      Page *cached = tc->get_cached_page(kind);
-      if (cached) {
-        void *fast = nullptr;
-        page_status_t before = EMPTY;
         page_status_t after = EMPTY;
-        if (mt) {
-          std::lock_guard<std::mutex> lk(page_lock_for(cached));
-          if (!cached->is_initialized()) {
-            tc->clear_cached_page(kind, cached);
-          } else {
-            fast = cached->allocate(need, &before, &after);
-          }
-        } else {
-          if (cached->is_initialized())
-            fast = cached->allocate(need, &before, &after);
-          else
-            tc->clear_cached_page(kind, cached);
-        }
-        if (fast) {
-          g_last_alloc_usable = cached->get_chunk_usable();
-          return fast;
+        void *ptr = nullptr;
+        if (page->get_class_index() == cls)
+          ptr = page->get_owner_segment()->allocate_on_page(page, need, &after);
+        if (!ptr) {
+          release_page(page);
+          continue;
         }
+        if (n != node)
+          nodes[n].remote_pages.fetch_add(1, std::memory_order_relaxed);
+        stat_add(COUNTER_page_queue_hits);
+        adopt(page);
+        return ptr;
       }
-    }
+      return nullptr;
+    };
 
-    auto try_segment = [&](size_t seg_idx) -> void * {
-      if (seg_idx >= layout.size())
-        return nullptr;
-      Segment *seg = layout[seg_idx].get();
+    if (void *ptr = probe_pages(node))
+      return ptr;
+
+    // past the lock-free paths: a good spot to pay for purging
+    maybe_purge(tid);
+
+    // `requeue_miss` false leaves a segment that had nothing to give for the
+    // caller to push back, so a probe loop doesn't pop it straight off again
+    auto try_segment = [&](size_t seg_idx, bool requeue_miss = true) -> void * {
+        Segment *seg = segment_at(seg_idx);
       if (!seg || seg->get_size_class() != kind)
         return nullptr;
-      if (!seg->can_hold_request(need))
-        return nullptr;
 
       Page *page = nullptr;
-      void *ptr = seg->allocate(need, &page);
-      if (seg->has_free_pages() && seg->can_hold_request(need))
+      page_status_t after = EMPTY;
+      void *ptr = seg->allocate(cls, need, tid, &page, &after);
+      if ((ptr || requeue_miss) && seg->has_free_pages())
         enqueue_non_full_segment(kind, seg_idx);
 
       if (!ptr) {
         return nullptr;
       }
 
-      if (tc->get_active()) {
+      if (seg->get_numa_node() != node)
+        nodes[seg->get_numa_node()].remote_pages.fetch_add(1, std::memory_order_relaxed);
+      else if (tc->get_active())
         tc->set_preferred_segment(kind, seg_idx);
-        if (page)
-          tc->cache_page(kind, page);
-      }
-      if (page)
-        g_last_alloc_usable = page->get_chunk_usable();
+      adopt(page);
       return ptr;
     };
 
     if (tc->get_active()) {
       size_t preferred = 0;
       if (tc->get_preferred_segment(kind, &preferred)) {
-        if (void *ptr = try_segment(preferred))
-          return ptr;
+        // a thread that migrated nodes stops preferring the old node's segment
+        Segment *seg = segment_at(preferred);
+        if (seg && seg->get_numa_node() == node) {
+          if (void *ptr = try_segment(preferred)) {
+            stat_add(COUNTER_preferred_hits);
+            return ptr;
+          }
+        }
       }
     }
 
-    // shard queue of known non-full segments
-    {
-      ClassShard &shard = shard_for(kind);
+    // shard queue of segments with pages that can be tuned to any class
+    auto probe_segments = [&](unsigned n) -> void * {
+      ClassShard &shard = shard_for(n, kind);
+      std::array<Segment *, MAX_QUEUE_PROBES_PER_ALLOC> missed;
       size_t probes = 0;
+      void *ptr = nullptr;
       while (probes < MAX_QUEUE_PROBES_PER_ALLOC) {
-        size_t idx = SIZE_MAX;
-        {
-          std::lock_guard<std::mutex> lk(shard.mu);
-          if (shard.non_full_segments.empty())
-            break;
-          idx = shard.non_full_segments.front();
-          shard.non_full_segments.pop_front();
-        }
-        probes++;
-
-        if (idx >= layout.size())
-          continue;
-        Segment *seg = layout[idx].get();
-        if (!seg || seg->get_size_class() != kind)
-          continue;
+        Segment *seg = shard.non_full_segments.pop();
+        if (!seg)
+          break;
+        stat_add(COUNTER_shard_queue_probes);
         seg->clear_enqueued();
 
-        if (void *ptr = try_segment(idx))
-          return ptr;
+        ptr = try_segment(seg->get_index(), false);
+        if (ptr) {
+          stat_add(COUNTER_shard_queue_hits);
+          break;
+        }
+        missed[probes++] = seg;
       }
-    }
-
-    // snapshot all segments in class and try a subset
-    std::vector<size_t> candidates;
-    {
-      ClassShard &shard = shard_for(kind);
-      std::lock_guard<std::mutex> lk(shard.mu);
-      candidates = shard.segments;
-    }
+      for (size_t i = 0; i < probes; ++i)
+        enqueue_non_full_segment(kind, missed[i]->get_index());
+      return ptr;
+    };
 
-    size_t fallback_scans = 0;
-    for (size_t idx : candidates) {
-      if (fallback_scans >= MAX_FALLBACK_SCANS_PER_ALLOC)
-        break;
-      fallback_scans++;
-      if (void *ptr = try_segment(idx))
-        return ptr;
-    }
+    if (void *ptr = probe_segments(node))
+      return ptr;
 
     // grow from reserved heap (ideal) instead of mmaping more mem to expand.
     {
-      std::lock_guard<std::mutex> lk(heap_mu);
-      if (add_segment_from_reserved_nolock(kind)) {
-        return try_segment(layout.size() - 1);
+      std::unique_lock<std::mutex> lk = lock_counted(heap_mu);
+      if (add_segment_from_reserved_nolock(kind, node)) {
+        return try_segment(num_segments.load(std::memory_order_relaxed) - 1);
       }
     }
 
+    // this node's slice is used up: other nodes' free memory beats mapping more
+    if (numa_nodes > 1)
+      stat_add(COUNTER_fallback_scans);
+    for (unsigned i = 1; i < numa_nodes; ++i) {
+      const unsigned other = (node + i) % numa_nodes;
+      if (void *ptr = probe_pages(other))
+        return ptr;
+      if (void *ptr = probe_segments(other))
+        return ptr;
+    }
+
     void *seg_mem = alloc_segment(SEGMENT_SIZE);
     if (!seg_mem)
       return nullptr;
+    if (numa_nodes > 1)
+      bind_to_node(seg_mem, SEGMENT_SIZE, node);
 
     {
-      std::lock_guard<std::mutex> lk(heap_mu);
-      if (!add_segment_nolock(seg_mem, kind)) {
+      std::unique_lock<std::mutex> lk = lock_counted(heap_mu);
+      if (!add_segment_nolock(seg_mem, kind, node, true)) {
         free_segment(seg_mem, SEGMENT_SIZE);
         return nullptr;
       }
-      return try_segment(layout.size() - 1);
+      stat_add(COUNTER_overflow_mmaps);
+      return try_segment(num_segments.load(std::memory_order_relaxed) - 1);
     }
   }
 
-  bool free_ptr(void *ptr, size_t *usable_out) {
+  // `size_hint` is the caller's claimed size (free_sized), 0 if unknown. an
+  // XL-sized hint goes straight to the XL path; a hint bigger than the slot
+  // means the caller is confused about the block and we abort.
+  bool free_ptr(void *ptr, size_t *usable_out, size_t size_hint = 0) {
     if (!ptr)
       return true;
+    if (size_hint != 0 && class_for_size(size_hint) == PAGE_XL)
+      return free_xl(ptr, usable_out, size_hint);
 
     ThreadCache *tc = ThreadCache::current();
     size_t seg_idx = 0;
     Segment *seg = nullptr;
     Page *page = nullptr;
     if (resolve_page_for_ptr(ptr, &seg_idx, &seg, &page)) {
-      const page_kind_t kind = page->get_size_class();
-      const pid_t owner_tid = page->get_owner_tid();
-      const bool remote_owner = (owner_tid != 0 && owner_tid != tc->get_tid());
+      if (size_hint > page->get_chunk_usable())
+        std::abort();
+      // only the owner may touch page state; everyone else goes through the
+      // page's remote-free path and lets the owner collect
+      if (page->get_owner_tid() != tc->get_tid()) {
+        if (!page->enqueue_deferred_free(ptr, usable_out)) {
+          stat_add(COUNTER_remote_push_fails);
+          return false;
+        }
+        stat_add(COUNTER_remote_frees);
+        note_remote_free(seg, tc->get_numa_node(), 1);
+        if (page->get_owner_tid() == 0) {
+          enqueue_non_full_page(page);
+          maybe_purge(tc->get_tid());
+        }
+        return true;
+      }
+
+      // owned small chunks park in the magazine. the uaf check needs the
+      // bitmap to tell live from free, so it bypasses magazines
+      const size_t cls = page->get_class_index();
+      if (!HeapPolicy::uaf_check && cls < TCACHE_CLASSES && tc->get_active()) {
+        if (!page->check_live_chunk(ptr))
+          return false;
+        constexpr bool scrub = HeapPolicy::zero_on_free;
+        if constexpr (scrub)
+          std::memset(ptr, 0, SIZE_CLASSES[cls].stride);
+        if (tc->magazine_push(cls, ptr, scrub)) {
+          if (usable_out)
+            *usable_out = SIZE_CLASSES[cls].stride;
+          return true;
+        }
+      }
 
-      bool ok = false;
       page_status_t before = EMPTY;
       page_status_t after = EMPTY;
+      if (!seg->free_on_page(page, ptr, usable_out, &before, &after))
+        return false;
+      if (before != EMPTY && after == EMPTY) {
+        enqueue_non_full_segment(seg->get_size_class(), seg_idx);
+        maybe_purge(tc->get_tid());
+      }
+      return true;
+    }
+
+    if (free_xl(ptr, usable_out, size_hint))
+      return true;
 
-      if (remote_owner) {
-        ok = page->enqueue_deferred_free(ptr, usable_out);
-        if (!ok) {
-          ok = seg->free_on_page(page, ptr, usable_out, &before, &after);
+    return false;
+  }
+
+  // frees pointers a window at a time: sort the window by address so
+  // pointers into one page sit together, then settle each run with one
+  // page lookup - owner runs clear bits directly, remote runs are linked
+  // into one chain and published with a single CAS.
+  bool free_bulk(void **ptrs, size_t n, size_t *freed_out, size_t *usable_out) {
+    ThreadCache *tc = ThreadCache::current();
+    return free_bulk_as(tc->get_tid(), tc->get_numa_node(), ptrs, n, freed_out, usable_out);
+  }
+
+  // `tid` is the freeing thread and `node` its numa node; magazine flushes
+  // pass them in because they also run from the thread cache's destructor
+  bool free_bulk_as(owner_id_t tid, unsigned node, void **ptrs, size_t n, size_t *freed_out,
+                    size_t *usable_out) {
+    static constexpr size_t BULK_FREE_WINDOW = 256;
+    std::array<void *, BULK_FREE_WINDOW> window;
+    size_t freed = 0;
+    size_t usable_total = 0;
+
+    for (size_t start = 0; start < n; start += BULK_FREE_WINDOW) {
+      const size_t end = std::min(n, start + BULK_FREE_WINDOW);
+      size_t m = 0;
+      for (size_t i = start; i < end; ++i) {
+        if (ptrs[i])
+          window[m++] = ptrs[i];
+      }
+      std::sort(window.begin(), window.begin() + m);
+
+      size_t i = 0;
+      while (i < m) {
+        size_t seg_idx = 0;
+        Segment *seg = nullptr;
+        Page *page = nullptr;
+        if (!resolve_page_for_ptr(window[i], &seg_idx, &seg, &page)) {
+          size_t usable = 0;
+          if (!free_xl(window[i], &usable))
+            return false;
+          usable_total += usable;
+          freed++;
+          i++;
+          continue;
         }
-      } else {
-        ok = seg->free_on_page(page, ptr, usable_out, &before, &after);
+
+        size_t j = i + 1;
+        while (j < m && page->contains_ptr(window[j]))
+          j++;
+
+        if (page->get_owner_tid() != tid) {
+          size_t usable = 0;
+          if (!page->enqueue_deferred_batch(&window[i], j - i, &usable)) {
+            stat_add(COUNTER_remote_push_fails);
+            return false;
+          }
+          stat_add(COUNTER_remote_frees, j - i);
+          note_remote_free(seg, node, j - i);
+          if (page->get_owner_tid() == 0) {
+            enqueue_non_full_page(page);
+            maybe_purge(tid);
+          }
+          usable_total += usable;
+        } else {
+          for (size_t k = i; k < j; ++k) {
+            size_t usable = 0;
+            page_status_t before = EMPTY;
+            page_status_t after = EMPTY;
+            if (!seg->free_on_page(page, window[k], &usable, &before, &after))
+              return false;
+            usable_total += usable;
+            if (before != EMPTY && after == EMPTY) {
+              enqueue_non_full_segment(seg->get_size_class(), seg_idx);
+              maybe_purge(tid);
+            }
+          }
+        }
+        freed += j - i;
+        i = j;
       }
+    }
 
-      if (!ok)
-        return false;
+    if (freed_out)
+      *freed_out = freed;
+    if (usable_out)
+      *usable_out = usable_total;
+    return true;
+  }
 
-      if (!remote_owner && before == FULL && after != FULL) {
-        enqueue_non_full_segment(kind, seg_idx);
+  // fill `out` with up to `n` blocks of `size`: whole runs come out of the
+  // owned page's bitmap, and the single-object path is only used to move on
+  // to the next page when that one runs dry
+  size_t allocate_batch(size_t size, size_t n, void **out) {
+    size_t got = 0;
+    if (class_for_size(size) == PAGE_XL) {
+      while (got < n) {
+        void *p = alloc_xl(size);
+        if (!p)
+          break;
+        out[got++] = p;
       }
+      return got;
+    }
 
-      if (tc->get_active()) {
-        tc->cache_page(kind, page);
-        if (page->get_status() == EMPTY)
-          tc->clear_cached_page(kind, page);
+    ThreadCache *tc = ThreadCache::current();
+    const size_t need = align_up(size, 16);
+    const size_t cls = size_class_for(need);
+    while (got < n) {
+      if (Page *owned = tc->get_owned_page(cls)) {
+        got += owned->get_owner_segment()->allocate_batch_on_page(owned, need, out + got,
+                                                                   n - got);
+        if (got == n)
+          break;
       }
+      void *p = allocate_in_class(cls, need);
+      if (!p)
+        break;
+      out[got++] = p;
+    }
+    g_last_alloc_usable = SIZE_CLASSES[cls].stride;
+    return got;
+  }
 
-      return true;
+  // zialloc_heap_t: one thread at a time allocates from a heap, but its
+  // blocks may be freed from anywhere through free_ptr
+  Heap *create_heap() {
+    void *mem = nullptr;
+    {
+      std::unique_lock<std::mutex> lk = lock_counted(heap_mu);
+      if (UserHeap *heap = free_heaps) {
+        free_heaps = heap->get_next_free();
+        return static_cast<Heap *>(heap); // destroyed heaps are left holding nothing
+      }
+      mem = meta.alloc(sizeof(Heap));
     }
+    if (!mem)
+      return nullptr;
+    return new (mem) Heap(g_next_heap_id.fetch_sub(1, std::memory_order_relaxed) - 1);
+  }
 
-    if (free_xl(ptr, usable_out))
+  void *allocate_in_heap(UserHeap *heap, size_t size) {
+    g_last_alloc_usable = 0;
+    g_last_alloc_dirty = SIZE_MAX;
+    if (class_for_size(size) == PAGE_XL) {
+      void *ptr = alloc_xl(size);
+      if (ptr)
+        heap->link_xl(xl_header_for(ptr));
+      return ptr;
+    }
+    const size_t need = align_up(size, 16);
+    return allocate_from_pages(heap, size_class_for(need), need);
+  }
+
+  // blocks the heap doesn't own are freed the ordinary way
+  bool free_in_heap(UserHeap *heap, void *ptr, size_t *usable_out) {
+    if (!ptr)
       return true;
+    size_t seg_idx = 0;
+    Segment *seg = nullptr;
+    Page *page = nullptr;
+    if (resolve_page_for_ptr(ptr, &seg_idx, &seg, &page)) {
+      if (page->get_owner_tid() != heap->get_tid())
+        return free_ptr(ptr, usable_out);
+      page_status_t before = EMPTY;
+      page_status_t after = EMPTY;
+      return seg->free_on_page(page, ptr, usable_out, &before, &after);
+    }
 
-    return false;
+    XLHeader *hdr = xl_header_for(ptr);
+    if (!hdr || hdr->magic != XL_MAGIC || hdr->heap != heap)
+      return free_ptr(ptr, usable_out);
+    if (__atomic_load_n(&hdr->heap_released, __ATOMIC_ACQUIRE) != 0)
+      std::abort();
+    if constexpr (HeapPolicy::zero_on_free)
+      std::memset(ptr, 0, hdr->usable_size);
+    if (usable_out)
+      *usable_out = hdr->usable_size;
+    heap->unlink_xl(hdr);
+    release_xl_mapping(hdr);
+    return true;
+  }
+
+  // drop every block `heap` holds in O(pages): each page's bitmap is reset
+  // in one go and its remote list discarded. `keep_current` (reset) keeps
+  // the page each class allocates from; all other pages go back to the
+  // shared pool EMPTY. `freed_out`/`usable_out` get what was still live.
+  void rewind_heap(UserHeap *heap, bool keep_current, size_t *freed_out, size_t *usable_out) {
+    size_t freed = 0;
+    size_t usable = 0;
+    heap->for_each_page(keep_current, [&](Page *page, bool keep) {
+      Segment *seg = page->get_owner_segment();
+      uint32_t live = 0;
+      const bool emptied = seg->rewind_page(page, &live);
+      freed += live;
+      usable += static_cast<size_t>(live) * page->get_chunk_usable();
+      if (keep)
+        return;
+      release_page(page);
+      if (emptied)
+        enqueue_non_full_segment(seg->get_size_class(), seg->get_index());
+    });
+
+    for (XLHeader *hdr = heap->take_xl_blocks(); hdr;) {
+      XLHeader *next = hdr->heap_next;
+      if (__atomic_load_n(&hdr->heap_released, __ATOMIC_ACQUIRE) == 0) {
+        freed++;
+        usable += hdr->usable_size;
+      }
+      hdr->heap = nullptr;
+      release_xl_mapping(hdr);
+      hdr = next;
+    }
+
+    if (freed_out)
+      *freed_out = freed;
+    if (usable_out)
+      *usable_out = usable;
+  }
+
+  void destroy_heap(UserHeap *heap, size_t *freed_out, size_t *usable_out) {
+    rewind_heap(heap, false, freed_out, usable_out);
+    std::unique_lock<std::mutex> lk = lock_counted(heap_mu);
+    heap->set_next_free(free_heaps);
+    free_heaps = heap;
   }
 
   size_t usable_size(void *ptr) {
@@ -1083,13 +2786,17 @@ public:
     return usable_xl(ptr);
   }
 
-  uint32_t get_num_segments() { return num_segments; }
+  uint32_t get_num_segments() {
+    return static_cast<uint32_t>(num_segments.load(std::memory_order_acquire));
+  }
 
   bool is_corrupted() {
     if (canary == 0)
       return true;
 
-    for (const auto &seg : layout) {
+    const size_t segs = num_segments.load(std::memory_order_acquire);
+    for (size_t i = 0; i < segs; ++i) {
+      const Segment *seg = layout[i];
       if (!seg || !seg->check_canary(seg->get_key()))
         return true;
     }
@@ -1100,76 +2807,325 @@ public:
     if (is_corrupted())
       return false;
 
-    for (const auto &seg : layout) {
-      if (!seg || seg->num_pages() == 0)
+    const size_t segs = num_segments.load(std::memory_order_acquire);
+    for (size_t i = 0; i < segs; ++i) {
+      if (!layout[i] || layout[i]->num_pages() == 0)
         return false;
     }
     return true;
   }
 
+  // one background tick: purge passes until the cursor has gone round the
+  // whole heap (at most BACKGROUND_PASSES_PER_TICK), which also folds in the
+  // remote frees of every unowned page they pass and requeues segments that
+  // regained room, then the XL cache decay. pages a thread owns are left to
+  // their owner.
+  void background_tick(owner_id_t tid) {
+    const uint64_t now = monotonic_ns();
+    {
+      std::lock_guard<std::mutex> lk(purge_mu);
+      next_purge_ns.store(now + PURGE_INTERVAL_NS, std::memory_order_relaxed);
+      for (size_t i = 0; i < BACKGROUND_PASSES_PER_TICK; ++i)
+        if (purge_pass_locked(tid, now))
+          break;
+    }
+    xl_cache.decay(now);
+    stat_add(COUNTER_background_ticks);
+  }
+
+  // fork handlers: take every heap lock in the order the allocator nests
+  // them (heap_mu -> commit -> purge_mu -> xl cache -> counter list) so no other
+  // thread is mid-update when the address space is copied; both sides drop
+  // them afterwards. the forking thread is the only thread in the child, so
+  // the child can unlock what it inherited. the queues are lock-free and
+  // every update is one CAS, so the child sees them whole; a node another
+  // thread was about to push stays marked queued but unlisted, and is only
+  // found again by segment scans.
+  void lock_for_fork() {
+    heap_mu.lock();
+    g_commit_mu.lock();
+    purge_mu.lock();
+    xl_cache.lock();
+    g_counter_mu.lock();
+  }
+
+  void unlock_after_fork() {
+    g_counter_mu.unlock();
+    xl_cache.unlock();
+    purge_mu.unlock();
+    g_commit_mu.unlock();
+    heap_mu.unlock();
+  }
+
   void clear_metadata() {
     std::lock_guard<std::mutex> lk(heap_mu);
-    if (base && reserved_size > 0) {
-      free_segment(base, reserved_size);
-    } else {
-      for (void *seg : seg_bases)
-        free_segment(seg, SEGMENT_SIZE);
+    ThreadCache::current()->reset();
+    xl_cache.flush();
+    const uintptr_t reserved_lo = reinterpret_cast<uintptr_t>(base);
+    const uintptr_t reserved_hi = reserved_lo + reserved_size;
+    const size_t segs = num_segments.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < segs; ++i) {
+      void *seg_base = layout[i]->get_base();
+      segment_map_set(seg_base, SEGMENT_SIZE, 0);
+      const uintptr_t s = reinterpret_cast<uintptr_t>(seg_base);
+      if (reserved_size == 0 || s < reserved_lo || s >= reserved_hi)
+        free_segment(seg_base, SEGMENT_SIZE);
     }
+    if (base && reserved_size > 0)
+      free_segment(base, reserved_size);
 
-    layout.clear();
-    seg_bases.clear();
+    // segments, pages and heaps are trivially destructible; dropping the
+    // arena is the whole teardown
+    num_segments.store(0, std::memory_order_release);
+    layout = nullptr;
+    free_heaps = nullptr;
+    meta.release();
 
-    for (ClassShard &shard : class_shards) {
-      std::lock_guard<std::mutex> shard_lk(shard.mu);
-      shard.segments.clear();
-      shard.non_full_segments.clear();
+    for (NodeHeap &nh : nodes) {
+      nh.clear();
+      nh.reserved_lo = nh.reserved_hi = nh.reserved_cursor = 0;
+    }
+    numa_nodes = 1;
+    g_numa_nodes.store(1, std::memory_order_relaxed);
+
+    {
+      std::lock_guard<std::mutex> purge_lk(purge_mu);
+      purge_seg_cursor = 0;
+      purge_page_cursor = 0;
+      next_purge_ns.store(0, std::memory_order_relaxed);
     }
+    g_retained_empty_bytes.store(0, std::memory_order_relaxed);
 
     base = nullptr;
     reserved_size = 0;
-    num_segments = 0;
     canary = 0;
-    reserved_cursor = 0;
+  }
+
+  unsigned get_numa_nodes() const { return numa_nodes; }
+
+  bool numa_node_stats(unsigned node, uint64_t *segments, uint64_t *remote_frees,
+                       uint64_t *remote_pages) const {
+    if (node >= numa_nodes)
+      return false;
+    const NodeHeap &nh = nodes[node];
+    if (segments)
+      *segments = nh.segments.load(std::memory_order_relaxed);
+    if (remote_frees)
+      *remote_frees = nh.remote_frees.load(std::memory_order_relaxed);
+    if (remote_pages)
+      *remote_pages = nh.remote_pages.load(std::memory_order_relaxed);
+    return true;
   }
 };
 
+static void release_page(Page *page) { HeapState::instance().release_page(page); }
+
+static void abandon_page(Page *page) { HeapState::instance().abandon_page(page); }
+
+static void flush_chunks(void **chunks, size_t n, owner_id_t tid, unsigned node) {
+  if (!HeapState::instance().free_bulk_as(tid, node, chunks, n, nullptr, nullptr))
+    std::abort();
+}
+
 } // namespace
 
 void heap_clear_metadata() { HeapState::instance().clear_metadata(); }
 
-bool heap_init_reserved(void *reserved_base, size_t size) {
-  return HeapState::instance().init_reserved(reserved_base, size);
+// the worker takes g_bg_mu only between ticks, never with a heap lock held,
+// so it goes first
+void heap_fork_prepare() {
+  pthread_mutex_lock(&g_bg_mu);
+  HeapState::instance().lock_for_fork();
 }
 
-bool heap_add_segment_for_class(page_kind_t kind) {
-  return HeapState::instance().add_segment_from_reserved(kind);
+void heap_fork_parent() {
+  HeapState::instance().unlock_after_fork();
+  pthread_mutex_unlock(&g_bg_mu);
+}
+
+// the worker didn't survive the fork: slow paths purge again in the child
+void heap_fork_child() {
+  HeapState::instance().unlock_after_fork();
+  g_bg_running = false;
+  g_background_active.store(false, std::memory_order_relaxed);
+  pthread_cond_init(&g_bg_cv, nullptr);
+  pthread_mutex_unlock(&g_bg_mu);
+}
+
+bool heap_init_reserved(void *reserved_base, size_t size) {
+  return HeapState::instance().init_reserved(reserved_base, size);
 }
 
 void *heap_alloc(size_t size) { return HeapState::instance().allocate(size); }
 
+void *heap_alloc_aligned(size_t size, size_t alignment) {
+  return HeapState::instance().allocate_aligned(size, alignment);
+}
+
 size_t heap_last_alloc_usable() { return g_last_alloc_usable; }
 
+size_t heap_last_alloc_dirty_bytes() { return g_last_alloc_dirty; }
+
 size_t heap_usable_size(void *ptr) { return HeapState::instance().usable_size(ptr); }
 
+// usable bytes a request of `size` would be given
+size_t heap_usable_for_request(size_t size) {
+  if (class_for_size(size) == PAGE_XL)
+    return xl_map_size_for(size) - sizeof(XLHeader);
+  return SIZE_CLASSES[size_class_for(align_up(size, 16))].stride;
+}
+
+void *heap_resize_xl(void *ptr, size_t size, size_t *new_usable) {
+  return HeapState::instance().resize_xl(ptr, size, new_usable);
+}
+
 bool free_dispatch_with_size(void *ptr, size_t *usable_size) {
   return HeapState::instance().free_ptr(ptr, usable_size);
 }
 
-void set_zero_on_free_enabled(bool enabled) {
-  g_zero_on_free.store(enabled, std::memory_order_relaxed);
+bool free_dispatch_sized(void *ptr, size_t size, size_t *usable_size) {
+  return HeapState::instance().free_ptr(ptr, usable_size, size);
+}
+
+bool free_dispatch_bulk(void **ptrs, size_t n, size_t *freed, size_t *usable_total) {
+  return HeapState::instance().free_bulk(ptrs, n, freed, usable_total);
+}
+
+size_t heap_alloc_batch(size_t size, size_t n, void **out) {
+  return HeapState::instance().allocate_batch(size, n, out);
+}
+
+Heap *heap_create() { return HeapState::instance().create_heap(); }
+
+void *heap_malloc(Heap *heap, size_t size) {
+  return HeapState::instance().allocate_in_heap(heap, size);
+}
+
+bool heap_free(Heap *heap, void *ptr, size_t *usable_size) {
+  return HeapState::instance().free_in_heap(heap, ptr, usable_size);
+}
+
+void heap_reset(Heap *heap, size_t *freed, size_t *usable_total) {
+  HeapState::instance().rewind_heap(heap, true, freed, usable_total);
+}
+
+void heap_destroy(Heap *heap, size_t *freed, size_t *usable_total) {
+  HeapState::instance().destroy_heap(heap, freed, usable_total);
 }
 
-void set_uaf_check_enabled(bool enabled) {
-  g_uaf_check.store(enabled, std::memory_order_relaxed);
+namespace {
+
+static void *background_main(void *) {
+  counters_attach();
+  const owner_id_t tid = next_thread_id();
+  pthread_mutex_lock(&g_bg_mu);
+  uint64_t next = monotonic_ns() + g_bg_interval_ns;
+  while (!g_bg_stop) {
+    const struct timespec deadline = {static_cast<time_t>(next / 1000000000ULL),
+                                      static_cast<long>(next % 1000000000ULL)};
+    if (pthread_cond_clockwait(&g_bg_cv, &g_bg_mu, CLOCK_MONOTONIC, &deadline) != ETIMEDOUT)
+      continue; // woken early: only stop does that, anything else is spurious
+    void (*on_tick)(uint64_t) = g_bg_on_tick;
+    pthread_mutex_unlock(&g_bg_mu);
+    HeapState::instance().background_tick(tid);
+    const uint64_t now = monotonic_ns();
+    if (on_tick)
+      on_tick(now);
+    next = now + g_bg_interval_ns;
+    pthread_mutex_lock(&g_bg_mu);
+  }
+  pthread_mutex_unlock(&g_bg_mu);
+  counters_detach();
+  return nullptr;
+}
+
+} // namespace
+
+// `on_tick` runs on the worker after each tick; it must not allocate
+bool background_start(uint64_t interval_ms, void (*on_tick)(uint64_t now_ns)) {
+  pthread_mutex_lock(&g_bg_mu);
+  if (g_bg_running || interval_ms == 0) {
+    pthread_mutex_unlock(&g_bg_mu);
+    return false;
+  }
+  g_bg_interval_ns = interval_ms * 1000000ULL;
+  g_bg_on_tick = on_tick;
+  g_bg_stop = false;
+  // signals are the application's business, never the worker's
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  const bool ok = pthread_create(&g_bg_thread, nullptr, background_main, nullptr) == 0;
+  pthread_sigmask(SIG_SETMASK, &old, nullptr);
+  if (ok) {
+    g_bg_running = true;
+    g_background_active.store(true, std::memory_order_relaxed);
+  }
+  pthread_mutex_unlock(&g_bg_mu);
+  return ok;
+}
+
+void background_stop() {
+  pthread_mutex_lock(&g_bg_mu);
+  if (!g_bg_running) {
+    pthread_mutex_unlock(&g_bg_mu);
+    return;
+  }
+  g_bg_stop = true;
+  pthread_cond_broadcast(&g_bg_cv);
+  pthread_mutex_unlock(&g_bg_mu);
+  pthread_join(g_bg_thread, nullptr);
+  pthread_mutex_lock(&g_bg_mu);
+  g_bg_running = false;
+  g_background_active.store(false, std::memory_order_relaxed);
+  pthread_mutex_unlock(&g_bg_mu);
+}
+
+void set_thread_exit_hook(void (*hook)()) {
+  g_thread_exit_hook.store(hook, std::memory_order_release);
+}
+
+void set_purge_policy(uint64_t delay_ms, size_t retained_budget) {
+  g_purge_delay_ns.store(delay_ms * 1000000ULL, std::memory_order_relaxed);
+  g_purge_retained_budget.store(retained_budget, std::memory_order_relaxed);
 }
 
 bool heap_validate() { return HeapState::instance().validate(); }
 
+// sums every thread's counters into `out`, in ZIALLOC_COUNTERS order
+void heap_counters(uint64_t *out, size_t n) {
+  const size_t count = n < COUNTER_COUNT ? n : COUNTER_COUNT;
+  std::memset(out, 0, n * sizeof(uint64_t));
+  std::lock_guard<std::mutex> lk(g_counter_mu);
+  for (size_t i = 0; i < count; ++i)
+    out[i] = g_retired_counters[i];
+  for (const CounterBlock *b = g_counter_head; b; b = b->next) {
+    for (size_t i = 0; i < count; ++i)
+      out[i] += b->v[i].load(std::memory_order_relaxed);
+  }
+}
+
+void heap_reset_counters() {
+  std::lock_guard<std::mutex> lk(g_counter_mu);
+  std::memset(g_retired_counters, 0, sizeof(g_retired_counters));
+  for (CounterBlock *b = g_counter_head; b; b = b->next) {
+    for (std::atomic<uint64_t> &v : b->v)
+      v.store(0, std::memory_order_relaxed);
+  }
+}
+
+unsigned heap_numa_nodes() { return HeapState::instance().get_numa_nodes(); }
+
+bool heap_numa_node_stats(unsigned node, uint64_t *segments, uint64_t *remote_frees,
+                          uint64_t *remote_pages) {
+  return HeapState::instance().numa_node_stats(node, segments, remote_frees, remote_pages);
+}
+
 } // namespace zialloc::memory
 
 /*
   TODOs:
-    - implement a toggle-able UAF checker in deffered ring, to act as pseudo temporal quarantining
+    - implement a toggle-able UAF checker in the remote free list, to act as pseudo temporal quarantining
     - Make XL allocations first take from our pre-reserved space instead of a custom mapping. 
         only expanding making a standalone mmap/mapping if there isn't adequate space in reserved heap. 
         it should start from the end and move towards the rest of the segments though so that the segments are contiguous
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
 #include "mem.h"
@@ -10,31 +11,99 @@ namespace zialloc::memory {
 size_t align_up(size_t size, size_t alignment);
 void* alloc_segment(size_t size);
 void free_segment(void* ptr, size_t size);
+void* remap_segment(void* ptr, size_t old_size, size_t new_size);
 void* reserve_region(size_t size);
+void* reserve_region_aligned(size_t size, size_t alignment);
 bool commit_region(void* ptr, size_t size);
 void decommit_pages(void* ptr, size_t size);
 void commit_pages(void* ptr, size_t size);
 bool setup_guard(void* ptr, size_t size);
 void lock_page(void* ptr, size_t size);
 void unlock_page(void* ptr, size_t size);
+void mapping_stats(size_t* bytes_mapped, uint64_t* mmap_calls, uint64_t* munmap_calls);
+void reset_mapping_stats();
+void set_huge_pages_enabled(bool enabled);
+bool huge_pages_enabled();
+unsigned numa_node_count();
+unsigned current_numa_node();
+bool bind_to_node(void* ptr, size_t size, unsigned node);
 
 bool free_dispatch_with_size(void* ptr, size_t* usable_size);
-void set_zero_on_free_enabled(bool enabled);
-void set_uaf_check_enabled(bool enabled);
+bool free_dispatch_sized(void* ptr, size_t size, size_t* usable_size);
+bool free_dispatch_bulk(void** ptrs, size_t n, size_t* freed, size_t* usable_total);
+void set_purge_policy(uint64_t delay_ms, size_t retained_budget);
+void set_thread_exit_hook(void (*hook)()); // runs as each thread's cache is torn down
+bool background_start(uint64_t interval_ms, void (*on_tick)(uint64_t now_ns));
+void background_stop();
 
 // heap allocation entry
 void* heap_alloc(size_t size);
+void* heap_alloc_aligned(size_t size, size_t alignment);
+size_t heap_alloc_batch(size_t size, size_t n, void** out);
 size_t heap_last_alloc_usable();
+size_t heap_last_alloc_dirty_bytes();
 size_t heap_usable_size(void* ptr);
+size_t heap_usable_for_request(size_t size);
+void* heap_resize_xl(void* ptr, size_t size, size_t* new_usable);
 bool heap_validate();
-bool heap_add_segment_for_class(page_kind_t kind);
+void heap_counters(uint64_t* out, size_t n);
+void heap_reset_counters();
+unsigned heap_numa_nodes();
+bool heap_numa_node_stats(unsigned node, uint64_t* segments, uint64_t* remote_frees,
+                          uint64_t* remote_pages);
 
 void heap_clear_metadata();
 bool heap_init_reserved(void* reserved_base, size_t size);
 
+// sampling heap profiler (profiler.cpp). profile_sample records `ptr` and
+// returns the byte countdown to the next sample; frees call profile_forget
+// only while profile_has_samples().
+extern std::atomic<size_t> g_profile_live_samples;
+inline bool profile_has_samples() {
+  return g_profile_live_samples.load(std::memory_order_relaxed) != 0;
+}
+bool profile_enable(size_t interval_bytes);
+bool profile_enabled();
+bool profile_install_signal(int signo);
+int64_t profile_sample(void* ptr, size_t size);
+void profile_forget(void* ptr);
+static constexpr uint64_t PROFILE_NO_SAMPLE = UINT64_MAX;
+uint64_t profile_detach(void* ptr); // PROFILE_NO_SAMPLE if `ptr` isn't sampled
+void profile_reattach(uint64_t handle, void* ptr, size_t size);
+int profile_dump(int fd);
+void profile_lock();
+void profile_unlock();
+
+// allocation trace recorder (trace.cpp). the entry points call trace_record
+// only while trace_enabled(); a ts of 0 means now.
+extern std::atomic<bool> g_trace_on;
+inline bool trace_enabled() { return g_trace_on.load(std::memory_order_relaxed); }
+uint64_t trace_now();
+void trace_record(uint32_t op, const void* ptr, const void* result, size_t size, uint64_t aux,
+                  uint64_t ts);
+bool trace_start(const char* path);
+bool trace_start_prefix(const char* prefix);
+int trace_stop();
+void trace_lock();
+void trace_unlock();
+void trace_fork_child(); // also drops the lock
+
+// pthread_atfork handlers
+void heap_fork_prepare();
+void heap_fork_parent();
+void heap_fork_child();
+
 class Chunk;
 class Page;
 class Segment;
 class Heap;
 
+// zialloc_heap_t backing. reset and destroy report the blocks that were
+// still live in `freed` / `usable_total`
+Heap* heap_create();
+void* heap_malloc(Heap* heap, size_t size);
+bool heap_free(Heap* heap, void* ptr, size_t* usable_size);
+void heap_reset(Heap* heap, size_t* freed, size_t* usable_total);
+void heap_destroy(Heap* heap, size_t* freed, size_t* usable_total);
+
 } // namespace zialloc::memory
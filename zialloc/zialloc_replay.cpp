@@ -0,0 +1,514 @@
+#define _POSIX_C_SOURCE 199309L
+
+// replays an allocation trace (zialloc_trace.h, recorded with ZIALLOC_TRACE
+// or zialloc_trace_start) against whichever allocator is linked in, so one
+// trace compares zialloc, glibc, jemalloc and mimalloc on the same workload.
+// every recorded thread gets a replay thread running its calls in order, as
+// fast as they go; a free of a block another thread allocated waits until
+// that allocation has been replayed. reports throughput, sampled per-call
+// latency histograms and rss over time.
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "allocator.h"
+#include "zialloc_trace.h"
+
+#define REPLAY_SAMPLE_EVERY 16
+#define REPLAY_BUCKETS 40 // log2 ns buckets; the last one takes everything larger
+#define REPLAY_RSS_MS_DEFAULT 10
+#define REPLAY_RSS_ROWS 20
+#define REPLAY_NONE UINT32_MAX
+#define REPLAY_PAGE 4096
+
+// allocator to replay against (provided by linked allocator object)
+extern "C" allocator_t *get_bench_allocator(void);
+
+static const char *const replay_op_names[] = {"", "malloc", "calloc", "memalign", "realloc",
+                                              "free"};
+#define REPLAY_OPS 6
+
+typedef struct {
+  uint32_t op;
+  uint32_t id;     // block passed in, REPLAY_NONE if none
+  uint32_t new_id; // block handed back, REPLAY_NONE if none
+  uint32_t pad;
+  uint64_t size;
+  uint64_t aux;
+} replay_op_t;
+
+typedef struct {
+  std::vector<replay_op_t> ops;
+  uint64_t hist[REPLAY_OPS][REPLAY_BUCKETS];
+  uint64_t max_ns[REPLAY_OPS];
+  uint64_t waits; // calls that had to wait on another thread's allocation
+  uint64_t end_ns;
+} replay_thread_t;
+
+typedef struct {
+  uint64_t t_ns;
+  size_t rss;
+} replay_rss_sample_t;
+
+static inline uint64_t replay_get_time_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// read(2) into a stack buffer: stdio would allocate from the allocator
+// under test while the replay threads run
+static size_t replay_get_rss(void) {
+  const int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return 0;
+  char buf[128];
+  const ssize_t n = read(fd, buf, sizeof(buf) - 1);
+  close(fd);
+  if (n <= 0)
+    return 0;
+  buf[n] = '\0';
+  const char *p = strchr(buf, ' ');
+  return p ? (size_t)strtoull(p + 1, nullptr, 10) * REPLAY_PAGE : 0;
+}
+
+static inline unsigned replay_bucket(uint64_t ns) {
+  const unsigned b = ns == 0 ? 0 : 64 - (unsigned)__builtin_clzll(ns);
+  return b < REPLAY_BUCKETS ? b : REPLAY_BUCKETS - 1;
+}
+
+static inline uint64_t replay_bucket_limit(unsigned b) { return b == 0 ? 0 : (1ULL << b) - 1; }
+
+static bool replay_load(const char *path, zialloc_trace_header_t *hdr,
+                        std::vector<zialloc_trace_record_t> *recs) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "replay: can't open %s\n", path);
+    return false;
+  }
+  if (fread(hdr, sizeof(*hdr), 1, f) != 1 || hdr->magic != ZIALLOC_TRACE_MAGIC ||
+      hdr->version != ZIALLOC_TRACE_VERSION ||
+      hdr->record_size != sizeof(zialloc_trace_record_t)) {
+    fprintf(stderr, "replay: %s is not a version %d zialloc trace\n", path,
+            ZIALLOC_TRACE_VERSION);
+    fclose(f);
+    return false;
+  }
+  // a trace cut short by a crash has no counts in the header: read to eof
+  zialloc_trace_record_t chunk[4096];
+  size_t n;
+  while ((n = fread(chunk, sizeof(chunk[0]), 4096, f)) > 0)
+    recs->insert(recs->end(), chunk, chunk + n);
+  fclose(f);
+  return true;
+}
+
+// the per-address queue of live block ids: with records sorted by time an
+// address can be handed out again before the free that released it sorts
+// in, so a release takes the oldest id at its address
+typedef struct {
+  uint32_t head;
+  uint32_t tail;
+} replay_addr_t;
+
+typedef struct {
+  std::unordered_map<uint64_t, replay_addr_t> live;
+  std::vector<uint32_t> next; // per id: the next id at the same address
+  uint32_t ids;
+} replay_resolver_t;
+
+static uint32_t replay_produce(replay_resolver_t *r, uint64_t addr) {
+  const uint32_t id = r->ids++;
+  r->next.push_back(REPLAY_NONE);
+  auto it = r->live.find(addr);
+  if (it == r->live.end()) {
+    r->live.emplace(addr, replay_addr_t{id, id});
+  } else {
+    r->next[it->second.tail] = id;
+    it->second.tail = id;
+  }
+  return id;
+}
+
+static uint32_t replay_consume(replay_resolver_t *r, uint64_t addr) {
+  auto it = r->live.find(addr);
+  if (it == r->live.end())
+    return REPLAY_NONE;
+  const uint32_t id = it->second.head;
+  if (id == it->second.tail)
+    r->live.erase(it);
+  else
+    it->second.head = r->next[id];
+  return id;
+}
+
+// sorts the records and turns addresses into block ids and threads into
+// per-thread call lists. calls that failed when recorded, and frees of
+// blocks from before the trace started, are left out.
+static void replay_build(std::vector<zialloc_trace_record_t> *recs,
+                         std::vector<replay_thread_t> *threads, uint32_t *ids,
+                         uint64_t *unmatched, uint64_t *failed) {
+  std::stable_sort(recs->begin(), recs->end(),
+                   [](const zialloc_trace_record_t &a, const zialloc_trace_record_t &b) {
+                     return a.ts_ns < b.ts_ns;
+                   });
+  replay_resolver_t r;
+  r.ids = 0;
+  std::unordered_map<uint32_t, size_t> thread_of;
+  for (const zialloc_trace_record_t &rec : *recs) {
+    replay_op_t op = {rec.op, REPLAY_NONE, REPLAY_NONE, 0, rec.size, rec.aux};
+    switch (rec.op) {
+    case ZIALLOC_TRACE_MALLOC:
+    case ZIALLOC_TRACE_CALLOC:
+    case ZIALLOC_TRACE_MEMALIGN:
+      if (rec.result == 0) {
+        (*failed)++;
+        continue;
+      }
+      op.new_id = replay_produce(&r, rec.result);
+      break;
+    case ZIALLOC_TRACE_REALLOC:
+      if (rec.ptr != 0 && rec.size == 0) { // realloc(p, 0) frees
+        op.op = ZIALLOC_TRACE_FREE;
+        op.id = replay_consume(&r, rec.ptr);
+        if (op.id == REPLAY_NONE) {
+          (*unmatched)++;
+          continue;
+        }
+        break;
+      }
+      if (rec.result == 0) {
+        (*failed)++;
+        continue;
+      }
+      if (rec.ptr != 0 && (op.id = replay_consume(&r, rec.ptr)) == REPLAY_NONE)
+        (*unmatched)++; // replayed as realloc(NULL, size)
+      op.new_id = replay_produce(&r, rec.result);
+      break;
+    case ZIALLOC_TRACE_FREE:
+      op.id = replay_consume(&r, rec.ptr);
+      if (op.id == REPLAY_NONE) {
+        (*unmatched)++;
+        continue;
+      }
+      break;
+    default:
+      continue;
+    }
+    auto it = thread_of.find(rec.tid);
+    if (it == thread_of.end()) {
+      it = thread_of.emplace(rec.tid, threads->size()).first;
+      threads->emplace_back();
+    }
+    (*threads)[it->second].ops.push_back(op);
+  }
+  *ids = r.ids;
+}
+
+typedef struct {
+  allocator_t *alloc;
+  void **blocks;
+  std::atomic<uint8_t> *ready; // per id: blocks[id] has been produced
+  bool touch;
+} replay_shared_t;
+
+static inline void replay_touch(void *p, uint64_t size) {
+  volatile char *c = static_cast<volatile char *>(p);
+  for (uint64_t off = 0; off < size; off += REPLAY_PAGE)
+    c[off] = 1;
+}
+
+static void replay_worker(const replay_shared_t *sh, replay_thread_t *t) {
+  allocator_t *alloc = sh->alloc;
+  size_t done = 0;
+  for (const replay_op_t &op : t->ops) {
+    void *in = nullptr;
+    if (op.id != REPLAY_NONE) {
+      if (!sh->ready[op.id].load(std::memory_order_acquire)) {
+        t->waits++;
+        while (!sh->ready[op.id].load(std::memory_order_acquire))
+          std::this_thread::yield();
+      }
+      in = sh->blocks[op.id];
+      sh->blocks[op.id] = nullptr;
+    }
+
+    const bool sample = (done++ % REPLAY_SAMPLE_EVERY) == 0;
+    const uint64_t t0 = sample ? replay_get_time_ns() : 0;
+    void *out = nullptr;
+    switch (op.op) {
+    case ZIALLOC_TRACE_MALLOC:
+      out = alloc->malloc(op.size);
+      break;
+    case ZIALLOC_TRACE_CALLOC:
+      if (alloc->calloc) {
+        out = alloc->calloc(op.aux, op.size);
+      } else if ((out = alloc->malloc(op.aux * op.size))) {
+        memset(out, 0, op.aux * op.size);
+      }
+      break;
+    case ZIALLOC_TRACE_MEMALIGN:
+      out = alloc->memalign ? alloc->memalign(op.aux, op.size)
+                            : alloc->aligned_alloc(op.aux, op.size);
+      break;
+    case ZIALLOC_TRACE_REALLOC:
+      out = alloc->realloc(in, op.size);
+      break;
+    case ZIALLOC_TRACE_FREE:
+      alloc->free(in);
+      break;
+    }
+    if (sample) {
+      const uint64_t ns = replay_get_time_ns() - t0;
+      t->hist[op.op][replay_bucket(ns)]++;
+      if (ns > t->max_ns[op.op])
+        t->max_ns[op.op] = ns;
+    }
+
+    if (op.new_id != REPLAY_NONE) {
+      const uint64_t size = op.op == ZIALLOC_TRACE_CALLOC ? op.aux * op.size : op.size;
+      if (out && sh->touch)
+        replay_touch(out, size);
+      sh->blocks[op.new_id] = out;
+      sh->ready[op.new_id].store(1, std::memory_order_release);
+    }
+  }
+  t->end_ns = replay_get_time_ns();
+}
+
+// the upper bound of the bucket holding quantile `q`, capped at the max seen
+static uint64_t replay_percentile(const uint64_t *hist, uint64_t total, uint64_t max_ns,
+                                  double q) {
+  const uint64_t want = (uint64_t)(q * (double)total);
+  uint64_t seen = 0;
+  unsigned b = 0;
+  for (; b < REPLAY_BUCKETS - 1; b++) {
+    seen += hist[b];
+    if (seen > want)
+      break;
+  }
+  const uint64_t limit = replay_bucket_limit(b);
+  return limit < max_ns ? limit : max_ns;
+}
+
+static void print_usage(void) {
+  printf("usage: replay <trace> [--csv] [--no-touch] [--rss-ms N]\n");
+  printf("  --csv       machine-readable output\n");
+  printf("  --no-touch  don't write one byte per page of each new block\n");
+  printf("  --rss-ms N  rss sampling period (default %d)\n", REPLAY_RSS_MS_DEFAULT);
+}
+
+int main(int argc, char **argv) {
+  const char *path = nullptr;
+  bool csv = false;
+  bool touch = true;
+  unsigned rss_ms = REPLAY_RSS_MS_DEFAULT;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--csv") == 0) {
+      csv = true;
+    } else if (strcmp(argv[i], "--no-touch") == 0) {
+      touch = false;
+    } else if (strcmp(argv[i], "--rss-ms") == 0 && i + 1 < argc) {
+      rss_ms = (unsigned)strtoul(argv[++i], nullptr, 10);
+      if (rss_ms == 0)
+        rss_ms = 1;
+    } else if (argv[i][0] != '-' && !path) {
+      path = argv[i];
+    } else {
+      print_usage();
+      return 1;
+    }
+  }
+  if (!path) {
+    print_usage();
+    return 1;
+  }
+
+  allocator_t *alloc = get_bench_allocator();
+  if (!alloc) {
+    fprintf(stderr, "ERROR: get_bench_allocator() returned NULL\n");
+    return 1;
+  }
+  if (alloc->init) {
+    int init_result = alloc->init();
+    if (init_result != 0) {
+      fprintf(stderr, "ERROR: Allocator init() failed with code %d\n", init_result);
+      return 1;
+    }
+  }
+
+  zialloc_trace_header_t hdr;
+  std::vector<zialloc_trace_record_t> recs;
+  if (!replay_load(path, &hdr, &recs))
+    return 1;
+  std::vector<replay_thread_t> threads;
+  uint32_t ids = 0;
+  uint64_t unmatched = 0, failed = 0;
+  replay_build(&recs, &threads, &ids, &unmatched, &failed);
+  const size_t records = recs.size();
+  std::vector<zialloc_trace_record_t>().swap(recs);
+  for (replay_thread_t &t : threads) {
+    memset(t.hist, 0, sizeof(t.hist));
+    memset(t.max_ns, 0, sizeof(t.max_ns));
+    t.waits = 0;
+    t.end_ns = 0;
+  }
+
+  std::unique_ptr<void *[]> blocks(new void *[ids]());
+  std::unique_ptr<std::atomic<uint8_t>[]> ready(new std::atomic<uint8_t>[ids]);
+  for (uint32_t i = 0; i < ids; i++)
+    ready[i].store(0, std::memory_order_relaxed);
+  const replay_shared_t sh = {alloc, blocks.get(), ready.get(), touch};
+
+  std::vector<replay_rss_sample_t> rss;
+  rss.reserve(1 << 16);
+  std::atomic<size_t> started{0};
+  std::atomic<size_t> finished{0};
+  std::atomic<bool> go{false};
+  std::vector<std::thread> workers;
+  workers.reserve(threads.size());
+  for (size_t i = 0; i < threads.size(); i++) {
+    workers.emplace_back([&, i] {
+      started.fetch_add(1, std::memory_order_release);
+      while (!go.load(std::memory_order_acquire))
+        std::this_thread::yield();
+      replay_worker(&sh, &threads[i]);
+      finished.fetch_add(1, std::memory_order_release);
+    });
+  }
+  while (started.load(std::memory_order_acquire) < threads.size())
+    std::this_thread::yield();
+
+  const uint64_t start = replay_get_time_ns();
+  rss.push_back({0, replay_get_rss()});
+  go.store(true, std::memory_order_release);
+  while (finished.load(std::memory_order_acquire) < threads.size()) {
+    struct timespec ts = {0, (long)rss_ms * 1000000L};
+    nanosleep(&ts, nullptr);
+    if (rss.size() < rss.capacity())
+      rss.push_back({replay_get_time_ns() - start, replay_get_rss()});
+  }
+  for (auto &w : workers)
+    w.join();
+  uint64_t end = start;
+  for (const replay_thread_t &t : threads)
+    if (t.end_ns > end)
+      end = t.end_ns;
+  rss.push_back({replay_get_time_ns() - start, replay_get_rss()});
+
+  // blocks the trace never freed, outside the timed part
+  size_t leaked = 0;
+  for (uint32_t i = 0; i < ids; i++) {
+    if (blocks[i]) {
+      alloc->free(blocks[i]);
+      leaked++;
+    }
+  }
+
+  uint64_t hist[REPLAY_OPS][REPLAY_BUCKETS] = {};
+  uint64_t count[REPLAY_OPS] = {};
+  uint64_t max_ns[REPLAY_OPS] = {};
+  uint64_t ops = 0, waits = 0;
+  for (const replay_thread_t &t : threads) {
+    ops += t.ops.size();
+    waits += t.waits;
+    for (unsigned o = 0; o < REPLAY_OPS; o++) {
+      for (unsigned b = 0; b < REPLAY_BUCKETS; b++) {
+        hist[o][b] += t.hist[o][b];
+        count[o] += t.hist[o][b];
+      }
+      if (t.max_ns[o] > max_ns[o])
+        max_ns[o] = t.max_ns[o];
+    }
+  }
+  size_t peak_rss = 0;
+  for (const replay_rss_sample_t &s : rss)
+    if (s.rss > peak_rss)
+      peak_rss = s.rss;
+  const uint64_t wall_ns = end - start;
+  const double throughput = wall_ns ? (double)ops * 1e9 / (double)wall_ns : 0.0;
+
+  if (csv) {
+    printf("allocator,threads,ops,wall_ns,ops_per_sec,cross_thread_waits,peak_rss_bytes\n");
+    printf("%s,%zu,%lu,%lu,%.0f,%lu,%zu\n", alloc->name, threads.size(), (unsigned long)ops,
+           (unsigned long)wall_ns, throughput, (unsigned long)waits, peak_rss);
+    printf("op,bucket_max_ns,samples\n");
+    for (unsigned o = 1; o < REPLAY_OPS; o++)
+      for (unsigned b = 0; b < REPLAY_BUCKETS; b++)
+        if (hist[o][b])
+          printf("%s,%lu,%lu\n", replay_op_names[o], (unsigned long)replay_bucket_limit(b),
+                 (unsigned long)hist[o][b]);
+    printf("t_ms,rss_bytes\n");
+    for (const replay_rss_sample_t &s : rss)
+      printf("%.1f,%zu\n", (double)s.t_ns / 1e6, s.rss);
+    return 0;
+  }
+
+  printf("replay %s on %s\n", path, alloc->name);
+  printf("  records:         %zu (%lu dropped while recording)\n", records,
+         (unsigned long)hdr.dropped);
+  printf("  replayed:        %lu calls on %zu threads\n", (unsigned long)ops, threads.size());
+  printf("  skipped:         %lu frees of blocks from before the trace, %lu failed calls\n",
+         (unsigned long)unmatched, (unsigned long)failed);
+  printf("  wall:            %.3f ms\n", (double)wall_ns / 1e6);
+  printf("  throughput:      %.0f ops/sec\n", throughput);
+  printf("  waits:           %lu calls waited on another thread\n", (unsigned long)waits);
+  printf("  never freed:     %zu blocks\n", leaked);
+
+  printf("latency (1 in %d calls, ns; percentiles are bucket upper bounds):\n",
+         REPLAY_SAMPLE_EVERY);
+  printf("  %-9s %10s %8s %8s %8s %10s\n", "call", "samples", "p50", "p99", "p99.9", "max");
+  for (unsigned o = 1; o < REPLAY_OPS; o++) {
+    if (!count[o])
+      continue;
+    printf("  %-9s %10lu %8lu %8lu %8lu %10lu\n", replay_op_names[o], (unsigned long)count[o],
+           (unsigned long)replay_percentile(hist[o], count[o], max_ns[o], 0.50),
+           (unsigned long)replay_percentile(hist[o], count[o], max_ns[o], 0.99),
+           (unsigned long)replay_percentile(hist[o], count[o], max_ns[o], 0.999),
+           (unsigned long)max_ns[o]);
+  }
+  printf("  %-9s", "<= ns");
+  for (unsigned o = 1; o < REPLAY_OPS; o++)
+    if (count[o])
+      printf(" %9s", replay_op_names[o]);
+  printf("\n");
+  for (unsigned b = 0; b < REPLAY_BUCKETS; b++) {
+    uint64_t row = 0;
+    for (unsigned o = 1; o < REPLAY_OPS; o++)
+      row += hist[o][b];
+    if (!row)
+      continue;
+    printf("  %-9lu", (unsigned long)replay_bucket_limit(b));
+    for (unsigned o = 1; o < REPLAY_OPS; o++)
+      if (count[o])
+        printf(" %9lu", (unsigned long)hist[o][b]);
+    printf("\n");
+  }
+
+  // the driver's own call lists are resident before the first call, so the
+  // growth column is what the replayed workload added
+  const size_t base_rss = rss.front().rss;
+  printf("rss (sampled every %u ms): peak %zu KiB, end %zu KiB, %zu KiB before the replay\n",
+         rss_ms, peak_rss / 1024, rss.back().rss / 1024, base_rss / 1024);
+  printf("  %10s %12s %12s\n", "ms", "KiB", "growth KiB");
+  const size_t step = rss.size() > REPLAY_RSS_ROWS ? rss.size() / REPLAY_RSS_ROWS : 1;
+  for (size_t i = 0; i < rss.size(); i += step)
+    printf("  %10.1f %12zu %12ld\n", (double)rss[i].t_ns / 1e6, rss[i].rss / 1024,
+           ((long)rss[i].rss - (long)base_rss) / 1024);
+  if ((rss.size() - 1) % step != 0)
+    printf("  %10.1f %12zu %12ld\n", (double)rss.back().t_ns / 1e6, rss.back().rss / 1024,
+           ((long)rss.back().rss - (long)base_rss) / 1024);
+  return 0;
+}
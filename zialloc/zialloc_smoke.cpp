@@ -0,0 +1,353 @@
+// smoke test for the zialloc-specific paths the harness tests can't reach:
+// cross-thread and bulk frees through the remote-free lists, heap reset and
+// destroy, fork then exit() with the background worker running, and a trace
+// round-trip through the recorder. given the path to libzialloc.so it also
+// reruns itself under LD_PRELOAD to check errno on the libc entry points.
+// every check prints a line; the exit status is the number that failed, so
+// `make run-smoke` fails with them.
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "allocator.h"
+#include "zialloc_stats.h"
+#include "zialloc_trace.h"
+
+#define SMOKE_THREADS 4
+#define SMOKE_BLOCKS 20000 // per producer
+#define SMOKE_FORKS 8
+#define SMOKE_CHILD_TIMEOUT_S 20
+
+extern "C" allocator_t *get_bench_allocator(void);
+
+static allocator_t *g_alloc = nullptr;
+static int g_failed = 0;
+
+static void smoke_check(bool ok, const char *what) {
+  printf("  %-52s %s\n", what, ok ? "ok" : "FAILED");
+  if (!ok)
+    g_failed++;
+}
+
+static size_t smoke_size(size_t i) {
+  // mostly small classes, some medium/large, the odd XL block
+  if (i % 4999 == 0)
+    return (size_t)(3 + i % 5) << 20;
+  if (i % 61 == 0)
+    return 8192 + (i * 131) % (256 * 1024);
+  return 1 + (i * 37) % 1024;
+}
+
+static uint8_t smoke_byte(const void *p) { return (uint8_t)((uintptr_t)p >> 4); }
+
+static void smoke_fill(void *p, size_t size) {
+  memset(p, smoke_byte(p), size < 64 ? size : 64);
+}
+
+static bool smoke_intact(const void *p, size_t size) {
+  const uint8_t *b = (const uint8_t *)p;
+  const size_t n = size < 64 ? size : 64;
+  for (size_t i = 0; i < n; ++i)
+    if (b[i] != smoke_byte(p))
+      return false;
+  return true;
+}
+
+static uint64_t smoke_outstanding(void) {
+  allocator_stats_t st;
+  if (!g_alloc->get_stats(&st))
+    return UINT64_MAX;
+  return st.alloc_count - st.free_count;
+}
+
+// every block is allocated on one thread and freed on another: producer t
+// hands its blocks to consumer (t + 1) % SMOKE_THREADS, which frees half one
+// by one (sized, every other) and half with one bulk_free
+static void smoke_cross_thread(void) {
+  printf("cross-thread free:\n");
+  const uint64_t before = smoke_outstanding();
+  std::vector<std::vector<void *>> blocks(SMOKE_THREADS);
+  std::atomic<int> produced{0};
+  std::atomic<bool> corrupt{false};
+  std::vector<std::thread> threads;
+  for (int t = 0; t < SMOKE_THREADS; ++t) {
+    threads.emplace_back([&, t] {
+      std::vector<void *> &mine = blocks[t];
+      mine.resize(SMOKE_BLOCKS);
+      for (size_t i = 0; i < SMOKE_BLOCKS; ++i) {
+        mine[i] = g_alloc->malloc(smoke_size(i));
+        if (mine[i])
+          smoke_fill(mine[i], smoke_size(i));
+      }
+      produced.fetch_add(1);
+      while (produced.load() < SMOKE_THREADS)
+        std::this_thread::yield();
+      std::vector<void *> &theirs = blocks[(t + 1) % SMOKE_THREADS];
+      for (size_t i = 0; i < SMOKE_BLOCKS; ++i) {
+        if (!theirs[i] || !smoke_intact(theirs[i], smoke_size(i)))
+          corrupt.store(true);
+      }
+      for (size_t i = 0; i < SMOKE_BLOCKS / 2; ++i) {
+        if (i % 2)
+          g_alloc->free_sized(theirs[i], smoke_size(i));
+        else
+          g_alloc->free(theirs[i]);
+      }
+      g_alloc->bulk_free(&theirs[SMOKE_BLOCKS / 2], SMOKE_BLOCKS - SMOKE_BLOCKS / 2);
+    });
+  }
+  for (std::thread &th : threads)
+    th.join();
+  smoke_check(!corrupt.load(), "blocks intact when the other thread frees them");
+  smoke_check(smoke_outstanding() == before, "every cross-thread free counted");
+  smoke_check(g_alloc->validate_heap(), "heap validates after the remote frees");
+
+  // the freed memory must be reusable from here
+  std::vector<void *> again(SMOKE_BLOCKS);
+  bool ok = true;
+  for (size_t i = 0; i < SMOKE_BLOCKS; ++i) {
+    again[i] = g_alloc->malloc(smoke_size(i));
+    ok &= again[i] != nullptr;
+  }
+  g_alloc->bulk_free(again.data(), again.size());
+  smoke_check(ok && smoke_outstanding() == before, "remote-freed memory serves new allocations");
+}
+
+static void smoke_heaps(void) {
+  printf("heaps:\n");
+  const uint64_t before = smoke_outstanding();
+  zialloc_heap_t *heap = zialloc_heap_create();
+  smoke_check(heap != nullptr, "zialloc_heap_create");
+  if (!heap)
+    return;
+  bool ok = true;
+  for (int round = 0; round < 3; ++round) {
+    for (size_t i = 0; i < SMOKE_BLOCKS; ++i) {
+      void *p = zialloc_heap_malloc(heap, smoke_size(i) % 4096 + 1);
+      ok &= p != nullptr;
+      if (p && i % 7 == 0)
+        zialloc_heap_free(heap, p);
+    }
+    zialloc_heap_reset(heap);
+  }
+  smoke_check(ok, "heap allocations across three reset rounds");
+  smoke_check(smoke_outstanding() == before, "reset releases every block");
+
+  // a heap block freed through plain free(), and one realloc'd out of it
+  void *a = zialloc_heap_malloc(heap, 100);
+  void *b = zialloc_heap_malloc(heap, 200);
+  g_alloc->free(a);
+  void *c = g_alloc->realloc(b, 5000);
+  g_alloc->free(c);
+  for (size_t i = 0; i < SMOKE_BLOCKS; ++i)
+    (void)zialloc_heap_malloc(heap, smoke_size(i) % 4096 + 1);
+  zialloc_heap_destroy(heap);
+  smoke_check(a && b && c && smoke_outstanding() == before, "destroy releases every block");
+  smoke_check(g_alloc->validate_heap(), "heap validates after destroy");
+}
+
+// children allocate, free and leave through exit(), so static destructors
+// run on state the fork copied mid-use. a hang is a failure, not a stall.
+static void smoke_fork(void) {
+  printf("fork (background worker %s):\n", getenv("ZIALLOC_BACKGROUND"));
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> churn;
+  for (int t = 0; t < 2; ++t) {
+    churn.emplace_back([&] {
+      std::vector<void *> v(256);
+      while (!stop.load()) {
+        for (size_t i = 0; i < v.size(); ++i)
+          v[i] = g_alloc->malloc(smoke_size(i));
+        for (void *p : v)
+          g_alloc->free(p);
+      }
+    });
+  }
+  int clean = 0;
+  for (int i = 0; i < SMOKE_FORKS; ++i) {
+    fflush(stdout);
+    const pid_t pid = fork();
+    if (pid == 0) {
+      alarm(SMOKE_CHILD_TIMEOUT_S);
+      std::vector<void *> v(SMOKE_BLOCKS);
+      for (size_t j = 0; j < v.size(); ++j)
+        v[j] = g_alloc->malloc(smoke_size(j));
+      std::thread remote([&] { g_alloc->bulk_free(v.data(), v.size()); });
+      remote.join();
+      exit(g_alloc->validate_heap() ? 0 : 1);
+    }
+    int status = 0;
+    if (pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) &&
+        WEXITSTATUS(status) == 0)
+      clean++;
+  }
+  stop.store(true);
+  for (std::thread &th : churn)
+    th.join();
+  smoke_check(clean == SMOKE_FORKS, "children allocate, free and exit() cleanly");
+  smoke_check(g_alloc->validate_heap(), "parent heap validates after the forks");
+}
+
+static bool smoke_read_all(int fd, void *buf, size_t len) {
+  char *p = (char *)buf;
+  while (len > 0) {
+    const ssize_t n = read(fd, p, len);
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+// records a known sequence and reads it back record by record
+static void smoke_trace(void) {
+  printf("trace round-trip:\n");
+  char path[] = "/tmp/zialloc_smoke.XXXXXX";
+  const int tmp = mkstemp(path);
+  if (tmp >= 0)
+    close(tmp);
+  smoke_check(tmp >= 0 && zialloc_trace_start(path), "zialloc_trace_start");
+  if (tmp < 0)
+    return;
+
+  const size_t n = 1000;
+  std::vector<void *> blocks(n);
+  for (size_t i = 0; i < n; ++i)
+    blocks[i] = g_alloc->malloc(smoke_size(i));
+  void *z = g_alloc->calloc(10, 48);
+  void *m = g_alloc->memalign(256, 100);
+  void *r = g_alloc->realloc(blocks[0], 50000);
+  blocks[0] = r;
+  for (size_t i = 0; i < n; ++i)
+    g_alloc->free(blocks[i]);
+  g_alloc->free(z);
+  g_alloc->free(m);
+  const uint64_t expected = n + 3 + n + 2;
+  smoke_check(zialloc_trace_stop() == 0, "zialloc_trace_stop");
+
+  zialloc_trace_header_t hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  std::vector<zialloc_trace_record_t> recs;
+  const int fd = open(path, O_RDONLY | O_CLOEXEC);
+  bool read_ok = fd >= 0 && smoke_read_all(fd, &hdr, sizeof(hdr)) &&
+                 hdr.magic == ZIALLOC_TRACE_MAGIC && hdr.version == ZIALLOC_TRACE_VERSION &&
+                 hdr.record_size == sizeof(zialloc_trace_record_t) && hdr.records == expected;
+  if (read_ok) {
+    recs.resize(hdr.records);
+    read_ok = smoke_read_all(fd, recs.data(), recs.size() * sizeof(recs[0]));
+  }
+  if (fd >= 0)
+    close(fd);
+  unlink(path);
+  smoke_check(read_ok, "header complete, record count matches the calls");
+  if (!read_ok)
+    return;
+
+  // one thread, so the file is in call order
+  bool match = true;
+  size_t k = 0;
+  for (size_t i = 0; i < n; ++i, ++k)
+    match &= recs[k].op == ZIALLOC_TRACE_MALLOC && recs[k].size == smoke_size(i);
+  match &= recs[k].op == ZIALLOC_TRACE_CALLOC && recs[k].aux == 10 && recs[k].size == 48 &&
+           recs[k].result == (uintptr_t)z;
+  k++;
+  match &= recs[k].op == ZIALLOC_TRACE_MEMALIGN && recs[k].aux == 256 &&
+           recs[k].result == (uintptr_t)m;
+  k++;
+  match &= recs[k].op == ZIALLOC_TRACE_REALLOC && recs[k].size == 50000 &&
+           recs[k].ptr == recs[0].result && recs[k].result == (uintptr_t)r;
+  k++;
+  for (size_t i = 0; i < n; ++i, ++k)
+    match &= recs[k].op == ZIALLOC_TRACE_FREE && recs[k].ptr == (uintptr_t)blocks[i];
+  for (size_t i = 1; i < recs.size(); ++i)
+    match &= recs[i].ts_ns >= recs[i - 1].ts_ns && recs[i].tid == recs[0].tid;
+  smoke_check(match, "records replay the calls in order");
+}
+
+// runs under LD_PRELOAD, so these are the shim's entry points. a request
+// bigger than the heap fails and must say ENOMEM; malloc(0) and
+// realloc(p, 0) aren't failures and leave errno alone.
+static void smoke_errno_probe(void) {
+  printf("errno (preloaded):\n");
+  volatile size_t huge = (size_t)1 << 42;
+  // through a pointer: the compiler can't tell a failed realloc kept `p`
+  void *(*volatile resize)(void *, size_t) = realloc;
+  void *p = malloc(16);
+  errno = 0;
+  smoke_check(!malloc(huge) && errno == ENOMEM, "malloc of 4TiB sets ENOMEM");
+  errno = 0;
+  smoke_check(!calloc(1, huge) && errno == ENOMEM, "calloc of 4TiB sets ENOMEM");
+  errno = 0;
+  smoke_check(!resize(p, huge) && errno == ENOMEM, "realloc to 4TiB sets ENOMEM");
+  errno = 0;
+  smoke_check(!aligned_alloc(64, huge) && errno == ENOMEM, "aligned_alloc of 4TiB sets ENOMEM");
+  errno = 0;
+  smoke_check(!valloc(huge) && errno == ENOMEM, "valloc of 4TiB sets ENOMEM");
+  void *q = nullptr;
+  errno = 0;
+  smoke_check(posix_memalign(&q, 64, huge) == ENOMEM && errno == 0,
+              "posix_memalign of 4TiB returns ENOMEM");
+  errno = 0;
+  void *z = malloc(0);
+  smoke_check(z && errno == 0, "malloc(0) leaves errno alone");
+  free(z);
+  errno = 0;
+  smoke_check(!resize(p, 0) && errno == 0, "realloc(p, 0) leaves errno alone");
+}
+
+static void smoke_errno(const char *self, const char *preload) {
+  if (!preload) {
+    printf("errno (preloaded):\n  %-52s %s\n", "no libzialloc.so given", "skipped");
+    return;
+  }
+  fflush(stdout);
+  const pid_t pid = fork();
+  if (pid == 0) {
+    setenv("LD_PRELOAD", preload, 1);
+    execl(self, self, "--errno", (char *)nullptr);
+    _exit(127);
+  }
+  int status = 0;
+  if (pid < 0 || waitpid(pid, &status, 0) != pid || !WIFEXITED(status) ||
+      WEXITSTATUS(status) == 127) {
+    smoke_check(false, "preloaded errno probe ran");
+    return;
+  }
+  g_failed += WEXITSTATUS(status);
+}
+
+int main(int argc, char **argv) {
+  if (argc > 1 && strcmp(argv[1], "--errno") == 0) {
+    smoke_errno_probe();
+    return g_failed;
+  }
+  // the worker starts at init, so the fork check runs with it on
+  setenv("ZIALLOC_BACKGROUND", "1", 0);
+  g_alloc = get_bench_allocator();
+  if (!g_alloc || g_alloc->init() != 0) {
+    fprintf(stderr, "ERROR: allocator init failed\n");
+    return 1;
+  }
+  printf("zialloc smoke test:\n");
+  smoke_cross_thread();
+  smoke_heaps();
+  smoke_fork();
+  smoke_trace();
+  g_alloc->teardown();
+  smoke_errno("/proc/self/exe", argc > 1 ? argv[1] : nullptr);
+  printf("%s: %d check%s failed\n", g_failed ? "FAILED" : "passed", g_failed,
+         g_failed == 1 ? "" : "s");
+  return g_failed;
+}
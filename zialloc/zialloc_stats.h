@@ -0,0 +1,92 @@
+#ifndef ZIALLOC_STATS_H
+#define ZIALLOC_STATS_H
+
+// zialloc extensions outside allocator_t. stats come in three tiers:
+//   get_stats            allocator_stats_t: counts, bytes, mmap activity
+//   zialloc_get_stats_ex that plus one counter per allocation-path tier
+//   zialloc_dump_stats   all of it as one line of json, for scraping
+// the tier counters are per thread and summed on read, so a snapshot taken
+// while other threads run is close but not exact. a ZIALLOC_NO_STATS build
+// compiles them out; they then read as 0.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "allocator.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// X(name): one counter per allocation-path tier and heap event, in order
+#define ZIALLOC_COUNTERS(X)                                                    \
+  X(magazine_hits)      /* malloc served from the thread's magazine */        \
+  X(magazine_refills)   /* empty magazine refilled from the owned page */     \
+  X(owned_page_hits)    /* served from the page the thread owns */            \
+  X(page_queue_hits)    /* adopted an unowned page from a class queue */      \
+  X(page_queue_probes)  /* pages popped off class queues */                   \
+  X(preferred_hits)     /* served from the thread's preferred segment */      \
+  X(shard_queue_hits)   /* served from a segment off a shard queue */         \
+  X(shard_queue_probes) /* segments popped off shard queues */                \
+  X(fallback_scans)     /* slow paths that searched other numa nodes */       \
+  X(reserved_growth)    /* segments carved from the reserved region */        \
+  X(overflow_mmaps)     /* segments mapped past the reserved region */        \
+  X(xl_allocs)          /* XL blocks handed out */                            \
+  X(xl_cache_hits)      /* XL blocks served from the span cache */            \
+  X(remote_frees)       /* chunks freed by a thread that isn't the owner */   \
+  X(remote_push_fails)  /* remote frees rejected as invalid or double */      \
+  X(drains)             /* remote-free lists collected by an owner */         \
+  X(lock_contended)     /* heap locks found already held */                   \
+  X(queue_retries)      /* queue CASes that lost a race and retried */        \
+  X(purge_passes)       /* purge passes run */                                \
+  X(background_ticks)   /* maintenance rounds run by the background worker */
+
+typedef struct zialloc_stats_s {
+  allocator_stats_t base;
+#define ZIALLOC_STATS_FIELD(name) uint64_t name;
+  ZIALLOC_COUNTERS(ZIALLOC_STATS_FIELD)
+#undef ZIALLOC_STATS_FIELD
+} zialloc_stats_t;
+
+bool zialloc_get_stats_ex(zialloc_stats_t *stats);
+// writes the snapshot as one json object and a newline straight to `fd`,
+// without touching the heap. 0 on success.
+int zialloc_dump_stats(int fd);
+
+// sampling heap profiler: about one allocation per `interval_bytes`
+// allocated records its stack; 0 turns it off and drops the samples. the
+// dump is a gperftools-format heap profile of the live samples for pprof.
+bool zialloc_profile_enable(size_t interval_bytes);
+int zialloc_profile_dump(int fd);
+
+// allocation tracing: from start until stop every malloc, calloc, memalign,
+// realloc and free through allocator_t is appended to the file at `path`
+// (format in zialloc_trace.h) for zialloc_replay. false if a trace is already
+// running or the file can't be created; stop is 0 once the file is complete.
+bool zialloc_trace_start(const char *path);
+int zialloc_trace_stop(void);
+
+// request-scoped heaps. a heap owns whole pages, so destroy frees every
+// block still in it with one pass over its pages instead of a free() per
+// block; reset does the same but keeps the heap and one page per size class
+// for the next round. a heap is used by one thread at a time, but its blocks
+// may be passed to free() or realloc() from anywhere (realloc moves them out
+// of the heap). heap blocks are never profiled.
+typedef struct zialloc_heap_s zialloc_heap_t;
+zialloc_heap_t *zialloc_heap_create(void);
+void *zialloc_heap_malloc(zialloc_heap_t *heap, size_t size);
+void zialloc_heap_free(zialloc_heap_t *heap, void *ptr);
+void zialloc_heap_reset(zialloc_heap_t *heap);
+void zialloc_heap_destroy(zialloc_heap_t *heap);
+
+size_t zialloc_malloc_batch(size_t size, size_t n, void **out);
+unsigned zialloc_numa_nodes(void);
+bool zialloc_numa_node_stats(unsigned node, uint64_t *segments, uint64_t *remote_frees,
+                             uint64_t *remote_pages);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ZIALLOC_STATS_H
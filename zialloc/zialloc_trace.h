@@ -0,0 +1,44 @@
+#ifndef ZIALLOC_TRACE_H
+#define ZIALLOC_TRACE_H
+
+// on-disk format of an allocation trace (trace.cpp writes it, zialloc_replay
+// reads it). a file is one header followed by fixed-size records in flush
+// order: each thread fills its own buffer and writes it out whole, so records
+// are only in time order within a thread and a reader sorts on ts_ns.
+// native byte order; traces aren't meant to move between machines.
+
+#include <stdint.h>
+
+#define ZIALLOC_TRACE_MAGIC 0x313045434152545aULL // "ZTRACE01" little-endian
+#define ZIALLOC_TRACE_VERSION 1
+
+enum {
+  ZIALLOC_TRACE_MALLOC = 1,   // size -> result
+  ZIALLOC_TRACE_CALLOC = 2,   // aux elements of size bytes -> result
+  ZIALLOC_TRACE_MEMALIGN = 3, // size aligned to aux -> result
+  ZIALLOC_TRACE_REALLOC = 4,  // ptr resized to size -> result
+  ZIALLOC_TRACE_FREE = 5,     // ptr
+};
+
+typedef struct zialloc_trace_header_s {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t record_size; // sizeof(zialloc_trace_record_t)
+  uint64_t start_ns;    // CLOCK_MONOTONIC when recording began
+  uint64_t records;     // written at stop; 0 if the process died first
+  uint64_t dropped;     // records lost to a full thread table
+  uint32_t threads;     // tids handed out, 1..threads
+  uint32_t pid;
+} zialloc_trace_header_t;
+
+typedef struct zialloc_trace_record_s {
+  uint64_t ts_ns;  // CLOCK_MONOTONIC; frees and reallocs at entry, the rest on return
+  uint64_t ptr;    // block passed in, 0 if none
+  uint64_t result; // block handed back, 0 if none or the call failed
+  uint64_t size;
+  uint64_t aux;
+  uint32_t tid; // dense per-thread index from 1, not the os tid
+  uint32_t op;
+} zialloc_trace_record_t;
+
+#endif // ZIALLOC_TRACE_H
@@ -2,18 +2,35 @@
 
 #include <math.h>
 #include <time.h>
+#include <unistd.h>
 
+#include <atomic>
+#include <cctype>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "allocator.h"
+#include "zialloc_stats.h"
 
 #define BENCH_MAX_SAMPLES 1000000
+#define BENCH_FRAG_SAMPLES 100000
+
+#define MT_SAMPLES_PER_THREAD 65536
+#define MT_SAMPLE_EVERY 16
+#define MT_BATCH 100
+#define MT_RING_SIZE 1024
+#define MT_LARSON_SLOTS 1000
+#define MT_LARSON_ROUNDS 8
+#define MT_SCRATCH_WRITES 64
 
 // allocator to benchmark/debug (provided by linked allocator object)
 extern "C" allocator_t *get_bench_allocator(void);
@@ -126,6 +143,71 @@ static inline void latency_free(latency_samples_t *ls) {
   ls->capacity = 0;
 }
 
+typedef struct {
+  size_t count;
+  size_t requested_bytes;
+} frag_bucket_t;
+
+// untimed pass over the same size distribution: group live blocks by usable
+// size (== size class stride) and report requested vs usable bytes per class
+static void bench_report_fragmentation(allocator_t *alloc, size_t samples,
+                                       size_t batch_size,
+                                       bench_metrics_t *metrics) {
+  if (!alloc->malloc || !alloc->free || !alloc->usable_size) {
+    printf("  fragmentation:   usable_size not implemented\n");
+    return;
+  }
+
+  void **batch = (void **)malloc(batch_size * sizeof(void *));
+  if (!batch)
+    return;
+
+  bench_rng_t rng;
+  bench_rng_seed(&rng, 0xFEEDFACE);
+
+  std::map<size_t, frag_bucket_t> buckets;
+  size_t total_requested = 0;
+  size_t total_usable = 0;
+  size_t done = 0;
+  while (done < samples) {
+    size_t n = 0;
+    for (; n < batch_size && done < samples; n++, done++) {
+      size_t sz = bench_rng_powerlaw(&rng, 16, 65536, 2.0);
+      batch[n] = alloc->malloc(sz);
+      if (!batch[n])
+        continue;
+      size_t usable = alloc->usable_size(batch[n]);
+      frag_bucket_t &b = buckets[usable];
+      b.count++;
+      b.requested_bytes += sz;
+      total_requested += sz;
+      total_usable += usable;
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (batch[i])
+        alloc->free(batch[i]);
+    }
+  }
+  free(batch);
+
+  metrics->fragmentation_ratio =
+      total_usable ? 1.0 - (double)total_requested / (double)total_usable : 0.0;
+
+  printf("  internal fragmentation by class (%zu samples):\n", samples);
+  printf("    %10s %10s %14s %14s %8s\n", "usable", "allocs", "requested",
+         "usable bytes", "waste");
+  for (const auto &kv : buckets) {
+    const size_t usable_bytes = kv.first * kv.second.count;
+    const double waste =
+        usable_bytes ? 100.0 * (1.0 - (double)kv.second.requested_bytes /
+                                          (double)usable_bytes)
+                     : 0.0;
+    printf("    %10zu %10zu %14zu %14zu %7.2f%%\n", kv.first, kv.second.count,
+           kv.second.requested_bytes, usable_bytes, waste);
+  }
+  printf("  fragmentation:   %.2f%%\n", 100.0 * metrics->fragmentation_ratio);
+}
+
 int bench(size_t iterations, size_t batch_size) {
   allocator_t *alloc = get_bench_allocator();
   if (!alloc) {
@@ -195,11 +277,535 @@ int bench(size_t iterations, size_t batch_size) {
   printf("  latency max:     %lu ns\n", (unsigned long)metrics.latency_max_ns);
   printf("  rss:             %zu bytes\n", metrics.rss_bytes);
 
+  bench_report_fragmentation(
+      alloc, iterations < BENCH_FRAG_SAMPLES ? iterations : BENCH_FRAG_SAMPLES,
+      batch_size, &metrics);
+
   free(batch);
   latency_free(&lat);
   return 0;
 }
 
+// ---- startup cost ----
+// teardown/init cycles: how long init and each kind's first malloc take, and
+// what they commit (bytes_mapped) and fault in (rss). the sizes land on
+// tiny, small, medium and large pages.
+
+#define STARTUP_KINDS 4
+
+static const size_t startup_sizes[STARTUP_KINDS] = {64, 4096, 1 << 20, 6 << 20};
+
+static size_t startup_committed(allocator_t *alloc) {
+  allocator_stats_t st;
+  if (!alloc->get_stats || !alloc->get_stats(&st))
+    return 0;
+  return st.bytes_mapped;
+}
+
+int startup_bench(size_t rounds) {
+  allocator_t *alloc = get_bench_allocator();
+  if (!alloc || !alloc->init || !alloc->teardown || !alloc->malloc || !alloc->free) {
+    fprintf(stderr, "ERROR: startup needs init/teardown/malloc/free\n");
+    return -1;
+  }
+  if (rounds == 0)
+    rounds = 1;
+
+  // [0] is init, [1 + k] the first malloc of startup_sizes[k]
+  uint64_t ns[STARTUP_KINDS + 1] = {0};
+  size_t committed[STARTUP_KINDS + 1] = {0};
+  size_t rss[STARTUP_KINDS + 1] = {0};
+  void *blocks[STARTUP_KINDS];
+  for (size_t r = 0; r < rounds; ++r) {
+    alloc->teardown();
+    const size_t rss0 = bench_get_rss();
+    uint64_t t0 = bench_get_time_ns();
+    if (alloc->init() != 0) {
+      fprintf(stderr, "ERROR: init failed\n");
+      return -1;
+    }
+    ns[0] += bench_get_time_ns() - t0;
+    committed[0] = startup_committed(alloc);
+    rss[0] = bench_get_rss() - rss0;
+    for (size_t k = 0; k < STARTUP_KINDS; ++k) {
+      t0 = bench_get_time_ns();
+      blocks[k] = alloc->malloc(startup_sizes[k]);
+      ns[1 + k] += bench_get_time_ns() - t0;
+      committed[1 + k] = startup_committed(alloc);
+      rss[1 + k] = bench_get_rss() - rss0;
+    }
+    for (size_t k = 0; k < STARTUP_KINDS; ++k)
+      alloc->free(blocks[k]);
+  }
+
+  printf("startup (%zu rounds, mean time; committed/rss are totals so far):\n", rounds);
+  printf("  %-14s %12s %14s %12s\n", "step", "ns", "committed", "rss");
+  for (size_t i = 0; i <= STARTUP_KINDS; ++i) {
+    char label[32];
+    if (i == 0)
+      snprintf(label, sizeof(label), "init");
+    else
+      snprintf(label, sizeof(label), "malloc(%zu)", startup_sizes[i - 1]);
+    printf("  %-14s %12lu %14zu %12zu\n", label, (unsigned long)(ns[i] / rounds),
+           committed[i], rss[i]);
+  }
+  return 0;
+}
+
+// ---- multi-threaded suite ----
+// every scenario runs N workers released together from a start flag; each
+// worker samples its own op latency, the main thread polls RSS for the peak
+
+typedef struct {
+  allocator_t *alloc;
+  size_t id;
+  size_t nthreads;
+  size_t ops;
+  size_t done_ops;
+  uint64_t start_ns;
+  uint64_t end_ns;
+  uint64_t busy_ns;
+  bench_rng_t rng;
+  latency_samples_t lat;
+  void *shared;
+} mt_worker_t;
+
+typedef struct {
+  const char *scenario;
+  size_t threads;
+  size_t ops;
+  uint64_t wall_ns;
+  double ops_per_thread_sec;
+  size_t peak_rss;
+  bench_metrics_t metrics;
+} mt_result_t;
+
+typedef void (*mt_worker_fn)(mt_worker_t *);
+
+static inline void mt_record(mt_worker_t *w, uint64_t ns) {
+  if ((w->done_ops & (MT_SAMPLE_EVERY - 1)) == 0)
+    latency_record(&w->lat, ns);
+}
+
+// spawns one fresh thread per worker, so repeated calls also churn threads
+static uint64_t mt_run(mt_worker_fn fn, mt_worker_t *workers, size_t n,
+                       size_t *peak_rss) {
+  std::atomic<size_t> ready{0};
+  std::atomic<size_t> finished{0};
+  std::atomic<bool> go{false};
+  std::vector<std::thread> threads;
+  threads.reserve(n);
+  for (size_t i = 0; i < n; i++) {
+    threads.emplace_back([&, i] {
+      ready.fetch_add(1, std::memory_order_release);
+      while (!go.load(std::memory_order_acquire))
+        std::this_thread::yield();
+      mt_worker_t *w = &workers[i];
+      uint64_t t0 = bench_get_time_ns();
+      fn(w);
+      w->end_ns = bench_get_time_ns();
+      w->busy_ns += w->end_ns - t0;
+      finished.fetch_add(1, std::memory_order_release);
+    });
+  }
+  while (ready.load(std::memory_order_acquire) < n)
+    std::this_thread::yield();
+
+  size_t peak = bench_get_rss();
+  uint64_t start = bench_get_time_ns();
+  go.store(true, std::memory_order_release);
+  while (finished.load(std::memory_order_acquire) < n) {
+    struct timespec ts = {0, 1000000};
+    nanosleep(&ts, nullptr);
+    size_t rss = bench_get_rss();
+    if (rss > peak)
+      peak = rss;
+  }
+  for (auto &t : threads)
+    t.join();
+
+  uint64_t end = start;
+  for (size_t i = 0; i < n; i++) {
+    if (workers[i].end_ns > end)
+      end = workers[i].end_ns;
+  }
+  if (*peak_rss < peak)
+    *peak_rss = peak;
+  return end - start;
+}
+
+// same loop as `bench`, one copy per thread
+static void mt_scaling_worker(mt_worker_t *w) {
+  allocator_t *alloc = w->alloc;
+  void *batch[MT_BATCH];
+  while (w->done_ops < w->ops) {
+    size_t n = 0;
+    for (; n < MT_BATCH && w->done_ops < w->ops; n++) {
+      size_t sz = bench_rng_powerlaw(&w->rng, 16, 65536, 2.0);
+      uint64_t t0 = bench_get_time_ns();
+      batch[n] = alloc->malloc(sz);
+      mt_record(w, bench_get_time_ns() - t0);
+      w->done_ops++;
+    }
+    for (size_t i = 0; i < n; i++)
+      alloc->free(batch[i]);
+  }
+}
+
+// producer-consumer: even workers allocate into a ring, the odd partner
+// frees, so every free is a cross-thread free
+typedef struct {
+  alignas(64) std::atomic<size_t> head;
+  alignas(64) std::atomic<size_t> tail;
+  void *slots[MT_RING_SIZE];
+} mt_ring_t;
+
+static void mt_prodcons_worker(mt_worker_t *w) {
+  allocator_t *alloc = w->alloc;
+  mt_ring_t *ring = &((mt_ring_t *)w->shared)[w->id / 2];
+  if ((w->id & 1) == 0) {
+    while (w->done_ops < w->ops) {
+      size_t head = ring->head.load(std::memory_order_relaxed);
+      if (head - ring->tail.load(std::memory_order_acquire) == MT_RING_SIZE) {
+        std::this_thread::yield();
+        continue;
+      }
+      size_t sz = bench_rng_powerlaw(&w->rng, 16, 4096, 2.0);
+      uint64_t t0 = bench_get_time_ns();
+      void *p = alloc->malloc(sz);
+      mt_record(w, bench_get_time_ns() - t0);
+      ring->slots[head % MT_RING_SIZE] = p;
+      ring->head.store(head + 1, std::memory_order_release);
+      w->done_ops++;
+    }
+    return;
+  }
+  while (w->done_ops < w->ops) {
+    size_t tail = ring->tail.load(std::memory_order_relaxed);
+    if (tail == ring->head.load(std::memory_order_acquire)) {
+      std::this_thread::yield();
+      continue;
+    }
+    void *p = ring->slots[tail % MT_RING_SIZE];
+    ring->tail.store(tail + 1, std::memory_order_release);
+    uint64_t t0 = bench_get_time_ns();
+    alloc->free(p);
+    mt_record(w, bench_get_time_ns() - t0);
+    w->done_ops++;
+  }
+}
+
+// larson: each worker replaces random slots of a live set; the set outlives
+// the thread and is handed to a different, newly spawned thread every round
+typedef struct {
+  void *slots[MT_LARSON_SLOTS];
+} mt_larson_set_t;
+
+static void mt_larson_worker(mt_worker_t *w) {
+  allocator_t *alloc = w->alloc;
+  mt_larson_set_t *set = (mt_larson_set_t *)w->shared;
+  for (size_t i = 0; i < w->ops; i++) {
+    size_t slot = bench_rng_next(&w->rng) % MT_LARSON_SLOTS;
+    size_t sz = 16 + bench_rng_next(&w->rng) % 1024;
+    uint64_t t0 = bench_get_time_ns();
+    alloc->free(set->slots[slot]);
+    set->slots[slot] = alloc->malloc(sz);
+    mt_record(w, bench_get_time_ns() - t0);
+    w->done_ops++;
+  }
+}
+
+// xmalloc-test: workers publish batches of fresh blocks on a shared list and
+// free whatever batch another worker published
+typedef struct {
+  size_t owner;
+  void *ptrs[MT_BATCH];
+} mt_xbatch_t;
+
+typedef struct {
+  std::mutex mu;
+  std::vector<mt_xbatch_t *> batches;
+} mt_exchange_t;
+
+static void mt_xmalloc_worker(mt_worker_t *w) {
+  allocator_t *alloc = w->alloc;
+  mt_exchange_t *ex = (mt_exchange_t *)w->shared;
+  while (w->done_ops < w->ops) {
+    mt_xbatch_t *mine = (mt_xbatch_t *)malloc(sizeof(mt_xbatch_t));
+    if (!mine)
+      return;
+    mine->owner = w->id;
+    for (size_t i = 0; i < MT_BATCH; i++) {
+      size_t sz = bench_rng_powerlaw(&w->rng, 16, 1024, 2.0);
+      uint64_t t0 = bench_get_time_ns();
+      mine->ptrs[i] = alloc->malloc(sz);
+      mt_record(w, bench_get_time_ns() - t0);
+      w->done_ops++;
+    }
+
+    mt_xbatch_t *theirs = nullptr;
+    {
+      std::lock_guard<std::mutex> g(ex->mu);
+      for (size_t i = ex->batches.size(); i-- > 0;) {
+        if (ex->batches[i]->owner != w->id) {
+          theirs = ex->batches[i];
+          ex->batches[i] = ex->batches.back();
+          ex->batches.pop_back();
+          break;
+        }
+      }
+      ex->batches.push_back(mine);
+    }
+    if (!theirs)
+      continue;
+    for (size_t i = 0; i < MT_BATCH; i++) {
+      uint64_t t0 = bench_get_time_ns();
+      alloc->free(theirs->ptrs[i]);
+      mt_record(w, bench_get_time_ns() - t0);
+      w->done_ops++;
+    }
+    free(theirs);
+  }
+}
+
+// cache-scratch: each worker frees a tiny block the main thread allocated,
+// then hammers its own tiny blocks; an allocator that hands neighbouring
+// threads the same cache line shows up as a throughput collapse
+static void mt_scratch_worker(mt_worker_t *w) {
+  allocator_t *alloc = w->alloc;
+  alloc->free(((void **)w->shared)[w->id]);
+  for (size_t i = 0; i < w->ops; i++) {
+    uint64_t t0 = bench_get_time_ns();
+    volatile char *p = (volatile char *)alloc->malloc(8);
+    mt_record(w, bench_get_time_ns() - t0);
+    if (p) {
+      for (size_t k = 0; k < MT_SCRATCH_WRITES; k++)
+        p[k & 7] = (char)(p[k & 7] + 1);
+    }
+    alloc->free((void *)p);
+    w->done_ops++;
+  }
+}
+
+// realloc growth: grow a block by ~1.5x from 16B up to 1MiB, touching the end
+static void mt_realloc_worker(mt_worker_t *w) {
+  allocator_t *alloc = w->alloc;
+  while (w->done_ops < w->ops) {
+    size_t sz = 16;
+    void *p = alloc->malloc(sz);
+    while (p && sz < (1u << 20) && w->done_ops < w->ops) {
+      sz += sz / 2 + bench_rng_next(&w->rng) % 64;
+      uint64_t t0 = bench_get_time_ns();
+      void *q = alloc->realloc(p, sz);
+      mt_record(w, bench_get_time_ns() - t0);
+      w->done_ops++;
+      if (!q)
+        break;
+      p = q;
+      ((char *)p)[sz - 1] = 1;
+    }
+    alloc->free(p);
+  }
+}
+
+static void mt_workers_init(mt_worker_t *workers, size_t n, allocator_t *alloc,
+                            size_t ops, void *shared) {
+  for (size_t i = 0; i < n; i++) {
+    mt_worker_t *w = &workers[i];
+    memset(w, 0, sizeof(*w));
+    w->alloc = alloc;
+    w->id = i;
+    w->nthreads = n;
+    w->ops = ops;
+    w->shared = shared;
+    bench_rng_seed(&w->rng, 0xFEEDFACE + i * 0x9E3779B97F4A7C15ULL);
+    w->lat.capacity = MT_SAMPLES_PER_THREAD;
+    w->lat.samples =
+        (uint64_t *)malloc(MT_SAMPLES_PER_THREAD * sizeof(uint64_t));
+    if (!w->lat.samples)
+      w->lat.capacity = 0;
+  }
+}
+
+static void mt_collect(const char *scenario, mt_worker_t *workers, size_t n,
+                       uint64_t wall_ns, size_t peak_rss, mt_result_t *out) {
+  latency_samples_t all{};
+  size_t samples = 0;
+  for (size_t i = 0; i < n; i++)
+    samples += workers[i].lat.count;
+  all.samples = (uint64_t *)malloc((samples ? samples : 1) * sizeof(uint64_t));
+  all.capacity = all.samples ? samples : 0;
+
+  memset(out, 0, sizeof(*out));
+  out->scenario = scenario;
+  out->threads = n;
+  out->wall_ns = wall_ns;
+  out->peak_rss = peak_rss;
+  double per_thread = 0.0;
+  for (size_t i = 0; i < n; i++) {
+    mt_worker_t *w = &workers[i];
+    out->ops += w->done_ops;
+    if (w->busy_ns)
+      per_thread += (double)w->done_ops / ((double)w->busy_ns / 1e9);
+    for (size_t k = 0; k < w->lat.count; k++)
+      latency_record(&all, w->lat.samples[k]);
+    latency_free(&w->lat);
+  }
+  out->ops_per_thread_sec = per_thread / (double)n;
+  out->metrics.throughput_ops_sec =
+      wall_ns ? (double)out->ops / ((double)wall_ns / 1e9) : 0.0;
+  out->metrics.rss_bytes = peak_rss;
+  latency_compute(&all, &out->metrics);
+  latency_free(&all);
+}
+
+static void mt_print(const mt_result_t *r, bool csv) {
+  if (csv) {
+    printf("%s,%zu,%zu,%lu,%.0f,%.0f,%lu,%lu,%lu,%lu,%zu\n", r->scenario,
+           r->threads, r->ops, (unsigned long)r->wall_ns,
+           r->metrics.throughput_ops_sec, r->ops_per_thread_sec,
+           (unsigned long)r->metrics.latency_p50_ns,
+           (unsigned long)r->metrics.latency_p99_ns,
+           (unsigned long)r->metrics.latency_p999_ns,
+           (unsigned long)r->metrics.latency_max_ns, r->peak_rss);
+    return;
+  }
+  printf("  %-10s %4zu %14.0f %14.0f %8lu %8lu %8lu %10zu KiB\n", r->scenario,
+         r->threads, r->metrics.throughput_ops_sec, r->ops_per_thread_sec,
+         (unsigned long)r->metrics.latency_p50_ns,
+         (unsigned long)r->metrics.latency_p99_ns,
+         (unsigned long)r->metrics.latency_p999_ns, r->peak_rss / 1024);
+}
+
+static void mt_scenario(allocator_t *alloc, const std::string &name,
+                        size_t threads, size_t ops, bool csv) {
+  std::vector<mt_worker_t> workers(threads);
+  mt_result_t result;
+  size_t peak = 0;
+
+  if (name == "prodcons") {
+    threads &= ~(size_t)1;
+    if (threads < 2)
+      threads = 2;
+    workers.resize(threads);
+    std::vector<mt_ring_t> rings(threads / 2);
+    for (auto &r : rings) {
+      r.head.store(0, std::memory_order_relaxed);
+      r.tail.store(0, std::memory_order_relaxed);
+    }
+    mt_workers_init(workers.data(), threads, alloc, ops, rings.data());
+    uint64_t wall = mt_run(mt_prodcons_worker, workers.data(), threads, &peak);
+    mt_collect("prodcons", workers.data(), threads, wall, peak, &result);
+  } else if (name == "larson") {
+    std::vector<mt_larson_set_t> sets(threads);
+    for (auto &s : sets)
+      memset(s.slots, 0, sizeof(s.slots));
+    mt_workers_init(workers.data(), threads, alloc, ops / MT_LARSON_ROUNDS,
+                    nullptr);
+    uint64_t wall = 0;
+    for (size_t round = 0; round < MT_LARSON_ROUNDS; round++) {
+      for (size_t i = 0; i < threads; i++)
+        workers[i].shared = &sets[(i + round) % threads];
+      wall += mt_run(mt_larson_worker, workers.data(), threads, &peak);
+    }
+    for (auto &s : sets) {
+      for (void *p : s.slots)
+        alloc->free(p);
+    }
+    mt_collect("larson", workers.data(), threads, wall, peak, &result);
+  } else if (name == "xmalloc") {
+    mt_exchange_t ex;
+    mt_workers_init(workers.data(), threads, alloc, ops, &ex);
+    uint64_t wall = mt_run(mt_xmalloc_worker, workers.data(), threads, &peak);
+    for (mt_xbatch_t *b : ex.batches) {
+      for (void *p : b->ptrs)
+        alloc->free(p);
+      free(b);
+    }
+    mt_collect("xmalloc", workers.data(), threads, wall, peak, &result);
+  } else if (name == "scratch") {
+    std::vector<void *> seeds(threads);
+    for (auto &p : seeds)
+      p = alloc->malloc(8);
+    mt_workers_init(workers.data(), threads, alloc, ops, seeds.data());
+    uint64_t wall = mt_run(mt_scratch_worker, workers.data(), threads, &peak);
+    mt_collect("scratch", workers.data(), threads, wall, peak, &result);
+  } else if (name == "realloc") {
+    if (!alloc->realloc) {
+      printf("  realloc not implemented\n");
+      return;
+    }
+    mt_workers_init(workers.data(), threads, alloc, ops, nullptr);
+    uint64_t wall = mt_run(mt_realloc_worker, workers.data(), threads, &peak);
+    mt_collect("realloc", workers.data(), threads, wall, peak, &result);
+  } else {
+    return;
+  }
+  mt_print(&result, csv);
+}
+
+// `scaling` runs 1, 2, 4, ... below max_threads, then max_threads itself;
+// everything else runs at max_threads. ops is per worker.
+int mtbench(const std::string &scenario, size_t max_threads, size_t ops,
+            bool csv) {
+  allocator_t *alloc = get_bench_allocator();
+  if (!alloc || !alloc->malloc || !alloc->free) {
+    fprintf(stderr, "ERROR: allocator has no malloc/free\n");
+    return 1;
+  }
+  if (max_threads == 0) {
+    max_threads = std::thread::hardware_concurrency();
+    if (max_threads == 0)
+      max_threads = 1;
+  }
+  if (ops == 0) {
+    fprintf(stderr, "ERROR: ops must be > 0\n");
+    return 1;
+  }
+
+  static const char *const others[] = {"prodcons", "larson", "xmalloc",
+                                       "scratch", "realloc"};
+  const bool all = scenario == "all";
+  bool known = all || scenario == "scaling";
+  for (const char *name : others)
+    known |= scenario == name;
+  if (!known) {
+    printf("unknown mtbench scenario: %s\n", scenario.c_str());
+    return 1;
+  }
+
+  if (csv) {
+    printf("scenario,threads,ops,wall_ns,ops_per_sec,ops_per_sec_per_thread,"
+           "p50_ns,p99_ns,p999_ns,max_ns,peak_rss_bytes\n");
+  } else {
+    printf("mtbench results (%zu ops per thread):\n", ops);
+    printf("  %-10s %4s %14s %14s %8s %8s %8s %14s\n", "scenario", "thr",
+           "ops/sec", "ops/sec/thr", "p50 ns", "p99 ns", "p99.9 ns",
+           "peak rss");
+  }
+
+  if (all || scenario == "scaling") {
+    std::vector<size_t> counts;
+    for (size_t n = 1; n < max_threads; n *= 2)
+      counts.push_back(n);
+    counts.push_back(max_threads);
+    for (size_t n : counts) {
+      std::vector<mt_worker_t> workers(n);
+      mt_result_t result;
+      size_t peak = 0;
+      mt_workers_init(workers.data(), n, alloc, ops, nullptr);
+      uint64_t wall = mt_run(mt_scaling_worker, workers.data(), n, &peak);
+      mt_collect("scaling", workers.data(), n, wall, peak, &result);
+      mt_print(&result, csv);
+    }
+  }
+  for (const char *name : others) {
+    if (all || scenario == name)
+      mt_scenario(alloc, name, max_threads, ops, csv);
+  }
+  return 0;
+}
+
 static void print_help(void) {
   printf("commands:\n");
   printf("  help\n");
@@ -211,9 +817,12 @@ static void print_help(void) {
   printf("  fill <id> <byte> <count>\n");
   printf("  dump <id> <count>\n");
   printf("  list\n");
-  printf("  stats\n");
+  printf("  stats [json]\n");
   printf("  validate\n");
   printf("  bench [iterations] [batch_size]\n");
+  printf("  startup [rounds]\n");
+  printf("  mtbench [all|scaling|prodcons|larson|xmalloc|scratch|realloc] "
+         "[threads] [ops_per_thread] [csv]\n");
   printf("  quit\n");
 }
 
@@ -421,6 +1030,12 @@ int main(void) {
     }
 
     if (cmd == "stats") {
+      std::string fmt;
+      if (iss >> fmt && fmt == "json") {
+        if (zialloc_dump_stats(STDOUT_FILENO) != 0)
+          printf("stats dump failed\n");
+        continue;
+      }
       if (alloc->print_stats) {
         alloc->print_stats();
       } else {
@@ -452,6 +1067,40 @@ int main(void) {
       continue;
     }
 
+    if (cmd == "startup") {
+      size_t rounds = 10;
+      if (!(iss >> rounds))
+        rounds = 10;
+      // cycles teardown/init, which would drop the shell's blocks
+      if (!blocks.empty()) {
+        printf("startup: free the %zu live blocks first\n", blocks.size());
+        continue;
+      }
+      (void)startup_bench(rounds);
+      continue;
+    }
+
+    if (cmd == "mtbench") {
+      // threads 0 = hardware_concurrency; `csv` may appear anywhere
+      std::string scenario = "all";
+      size_t nums[2] = {0, 1000000};
+      size_t nnums = 0;
+      bool csv = false;
+      std::string tok;
+      while (iss >> tok) {
+        if (tok == "csv") {
+          csv = true;
+        } else if (isdigit((unsigned char)tok[0])) {
+          if (nnums < 2)
+            nums[nnums++] = strtoull(tok.c_str(), nullptr, 10);
+        } else {
+          scenario = tok;
+        }
+      }
+      (void)mtbench(scenario, nums[0], nums[1], csv);
+      continue;
+    }
+
     printf("unknown command: %s\n", cmd.c_str());
     print_help();
   }